@@ -54,18 +54,58 @@
 //  '__cplusplus' built-in macro constant.
 //
 // DEBUG_DRAW_MAX_*
-//  Sizes of internal intermediate buffers, which are allocated on initialization
-//  by the implementation. If you need to draw more primitives than the sizes of
-//  these buffers, you need to redefine the macros and recompile.
+//  Default sizes of internal intermediate buffers, which are allocated on initialization
+//  by the implementation. These are only the defaults for dd::ContextConfig, so each
+//  context can be given its own sizes at runtime by passing a config to dd::initialize().
 //
 // DEBUG_DRAW_VERTEX_BUFFER_SIZE
-//  Size in dd::DrawVertex elements of the intermediate vertex buffer used
+//  Default size in dd::DrawVertex elements of the intermediate vertex buffer used
 //  to batch primitives before sending them to dd::RenderInterface. A bigger
 //  buffer will reduce the number of calls to dd::RenderInterface when drawing
-//  large sets of debug primitives.
+//  large sets of debug primitives. Also overridable per context via dd::ContextConfig.
+//
+// DEBUG_DRAW_TEXT_ARENA_SIZE
+//  Default size in bytes of the per context arena that holds the text of the queued
+//  debug strings. Text is copied into it by dd::screenText() and dd::projectedText(),
+//  so queueing strings doesn't allocate memory. Also overridable via dd::ContextConfig.
+//
+// DEBUG_DRAW_QUEUE_CHUNK_SIZE
+//  Number of elements in each of the fixed-size chunks the internal draw queues
+//  are made of. Queues grow and shrink one chunk at a time. Unused chunks are
+//  kept in a per-queue pool, so they are only allocated once.
+//
+// DEBUG_DRAW_EXPIRY_WINDOW_MILLIS
+//  Width in milliseconds of the finest expiry time windows that timed draws are
+//  grouped in. Each flush frees whole windows of expired elements without looking
+//  at them, so an element can be drawn for up to this long past its duration.
+//
+// DEBUG_DRAW_RENDER_LAYERS
+//  Number of render layers draws can be tagged with via dd::setRenderLayer().
+//  Queues keep the elements of each layer and depth test state apart as they
+//  are added, so dd::flush() draws them in one pass per layer, without sorting.
+//
+// DEBUG_DRAW_LOD_PIXEL_ERROR
+//  Most error in pixels allowed for the queued spheres, cones, capsules and circles
+//  once a camera is set with dd::setView(). Shapes far from the camera are then
+//  expanded into far fewer lines, and large ones close to it into more.
+//
+// DEBUG_DRAW_QUANTIZED_POSITIONS
+//  If defined, queued points and lines store their positions as 16-bits integer
+//  offsets from an origin kept per queue chunk, instead of as 32-bits floats.
+//  This roughly halves the queue memory used by dense long-lived geometry, at
+//  the cost of snapping positions to a grid of DEBUG_DRAW_QUANTIZATION_STEP units.
+//  Points and lines out of range of their chunk's origin, as well as lines too
+//  long to quantize at all, keep float positions instead, taking the room of two
+//  elements in the queue.
+//
+// DEBUG_DRAW_NO_SIMD
+//  Queued points and lines are expanded into dd::DrawVertex batches with SSE2,
+//  AVX2 or NEON (AArch64) kernels when the compiler targets one of those instruction
+//  sets (e.g. -mavx2 for AVX2). Define this switch to always use plain scalar code.
+//  SIMD is not used with DEBUG_DRAW_QUANTIZED_POSITIONS.
 //
 // DEBUG_DRAW_OVERFLOWED(message)
-//  An error handler called if any of the DEBUG_DRAW_MAX_* sizes overflow.
+//  An error handler called if any of the queue sizes (see dd::ContextConfig) overflow.
 //  By default it just prints a message to stderr.
 //
 // DEBUG_DRAW_USE_STD_MATH
@@ -82,12 +122,9 @@
 //  a custom string type if necessary. The only requirements are that
 //  it provides a 'c_str()' method returning a null terminated
 //  const char* string and an assignment operator (=).
-//
-// DEBUG_DRAW_STR_DEALLOC_FUNC(str)
-//  If you define a custom string type for ddStr and it requires some
-//  extra cleanup besides the class destructor, you might define this
-//  function macro to perform said cleanup. It is called by dd::clear()
-//  and dd::shutdown() on every instance of the internal DebugString buffer.
+//  Note that ddStr is no longer used to store the debug strings (see
+//  DEBUG_DRAW_TEXT_ARENA_SIZE), so DEBUG_DRAW_STR_DEALLOC_FUNC is
+//  never called and doesn't have to be defined anymore.
 //
 // DEBUG_DRAW_NO_DEFAULT_COLORS
 //  If defined, doesn't add the set of predefined color constants inside
@@ -124,6 +161,10 @@
 // By default, they are defined to use std::malloc and std::free, respectively.
 // Note: If you redefine one, you must also provide the other.
 //
+// A context can also be given its own dd::Allocator via dd::ContextConfig, in which case
+// every allocation made for that context goes through it instead of DD_MALLOC/DD_MFREE.
+// Each request carries the alignment it needs and a tag telling what the memory is for.
+//
 // --------------------------------
 //  INTERFACING WITH YOUR RENDERER
 // --------------------------------
@@ -182,7 +223,8 @@
 // Max elements of each type at any given time.
 // We supply these reasonable defaults, but you can provide your
 // own tunned values to save memory or fit all of your debug data.
-// These are hard constraints. If not enough, change and recompile.
+// These are only the defaults used by dd::ContextConfig. Each context
+// can override them at runtime when calling dd::initialize().
 //
 #ifndef DEBUG_DRAW_MAX_STRINGS
     #define DEBUG_DRAW_MAX_STRINGS 512
@@ -196,6 +238,12 @@
     #define DEBUG_DRAW_MAX_LINES 32768
 #endif // DEBUG_DRAW_MAX_LINES
 
+// Spheres, cones, capsules, boxes and the like are queued as a single
+// shape each (three for a capsule), only expanded into lines when drawn.
+#ifndef DEBUG_DRAW_MAX_SHAPES
+    #define DEBUG_DRAW_MAX_SHAPES 2048
+#endif // DEBUG_DRAW_MAX_SHAPES
+
 //
 // Size in vertexes of a local buffer we use to sort elements
 // drawn with and without depth testing before submitting them to
@@ -203,12 +251,72 @@
 // (e.g. dd::RenderInterface calls) when drawing large amounts of
 // primitives. Less will obviously save more memory. Each DrawVertex
 // is about 32 bytes in size, we keep a context-specific array
-// with this many entries.
+// with this many entries. Renderers using VertexFormatCompact
+// get 16 bytes per point/line vertex sent to them instead.
 //
 #ifndef DEBUG_DRAW_VERTEX_BUFFER_SIZE
     #define DEBUG_DRAW_VERTEX_BUFFER_SIZE 4096
 #endif // DEBUG_DRAW_VERTEX_BUFFER_SIZE
 
+//
+// Size in bytes of the arena that stores the text of the queued
+// debug strings, including a null terminator for each. Two buffers
+// of this size are kept, since text of the strings that outlive a
+// flush is compacted from one into the other.
+//
+#ifndef DEBUG_DRAW_TEXT_ARENA_SIZE
+    #define DEBUG_DRAW_TEXT_ARENA_SIZE 16384
+#endif // DEBUG_DRAW_TEXT_ARENA_SIZE
+
+//
+// Number of elements in each chunk of the internal draw queues.
+// Queues are linked lists of these chunks, so a queue only needs
+// to allocate a new chunk when it grows past the last one, never
+// moving the elements already queued.
+//
+#ifndef DEBUG_DRAW_QUEUE_CHUNK_SIZE
+    #define DEBUG_DRAW_QUEUE_CHUNK_SIZE 256
+#endif // DEBUG_DRAW_QUEUE_CHUNK_SIZE
+
+//
+// Timed draws are grouped in windows of expiry dates, the finest
+// of them this many milliseconds wide, with coarser windows for
+// later dates. Smaller windows expire elements closer to their
+// exact expiry date, but keep more partially filled chunks.
+//
+#ifndef DEBUG_DRAW_EXPIRY_WINDOW_MILLIS
+    #define DEBUG_DRAW_EXPIRY_WINDOW_MILLIS 16
+#endif // DEBUG_DRAW_EXPIRY_WINDOW_MILLIS
+
+//
+// Number of render layers selectable with dd::setRenderLayer().
+// Layers are flushed in order, starting from layer 0.
+//
+#ifndef DEBUG_DRAW_RENDER_LAYERS
+    #define DEBUG_DRAW_RENDER_LAYERS 4
+#endif // DEBUG_DRAW_RENDER_LAYERS
+
+//
+// Size in world units of the grid that queued positions are snapped
+// to when DEBUG_DRAW_QUANTIZED_POSITIONS is defined. Each queue chunk
+// can then hold positions up to 32767 steps away from its origin on
+// each axis, so the default covers +/-128 units with ~4mm precision
+// if you measure your world in meters.
+//
+#ifndef DEBUG_DRAW_QUANTIZATION_STEP
+    #define DEBUG_DRAW_QUANTIZATION_STEP (1.0f / 256.0f)
+#endif // DEBUG_DRAW_QUANTIZATION_STEP
+
+//
+// Most distance in pixels that the lines of a queued sphere, cone,
+// capsule or circle may stray from its true outline once a camera
+// is given to dd::setView(). Each shape is drawn with the fewest
+// steps around that keep within this error at its screen size.
+//
+#ifndef DEBUG_DRAW_LOD_PIXEL_ERROR
+    #define DEBUG_DRAW_LOD_PIXEL_ERROR 1.0f
+#endif // DEBUG_DRAW_LOD_PIXEL_ERROR
+
 //
 // This macro is called with an error message if any of the above
 // sizes is overflowed during runtime. In a debug build, you might
@@ -296,7 +404,8 @@
 
 #ifndef DEBUG_DRAW_STRING_TYPE_DEFINED
     // ddStr:
-    //  String type used internally to store the debug text strings.
+    //  String type that was used internally to store the debug text strings.
+    //  Kept for compatibility with user code, the library no longer uses it.
     //  A custom string type must provide at least an assignment
     //  operator (=) and a 'c_str()' method that returns a
     //  null-terminated const char* string pointer. That's it.
@@ -512,6 +621,16 @@ void screenText(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,)
                 float scaling = 1.0f,
                 int durationMillis = 0);
 
+// Same as above, but takes a string that is not necessarily null-terminated,
+// such as the data() and size() of a string view. Only 'length' chars are read.
+void screenText(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,)
+                const char * str,
+                int length,
+                ddVec3_In pos,
+                ddVec3_In color,
+                float scaling = 1.0f,
+                int durationMillis = 0);
+
 // Add a 3D text label centered at the given world position that
 // gets projected to screen-space. The label always faces the viewer.
 // sx/sy, sw/sh are the viewport coordinates/size, in pixels.
@@ -526,6 +645,19 @@ void projectedText(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,)
                    float scaling = 1.0f,
                    int durationMillis = 0);
 
+// Same as above, but takes a string that is not necessarily null-terminated,
+// such as the data() and size() of a string view. Only 'length' chars are read.
+void projectedText(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,)
+                   const char * str,
+                   int length,
+                   ddVec3_In pos,
+                   ddVec3_In color,
+                   ddMat4x4_In vpMatrix,
+                   int sx, int sy,
+                   int sw, int sh,
+                   float scaling = 1.0f,
+                   int durationMillis = 0);
+
 // Add a set of three coordinate axis depicting the position and orientation of the given transform.
 // 'size' defines the size of the arrow heads. 'length' defines the length of the arrow's base line.
 void axisTriad(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,)
@@ -704,6 +836,40 @@ union DrawVertex
     } glyph;
 };
 
+//
+// Compact vertex for points and lines, 16 bytes instead of the 28 of a dd::DrawVertex.
+// Color is RGBA8 packed into a 32-bits integer, with red in the lowest byte and
+// alpha in the highest (always 255), so it maps to a 4 x UNSIGNED_BYTE normalized
+// vertex attribute in little-endian memory. Points drawn with this format don't
+// carry a size per vertex, the size is given per batch instead.
+//
+struct CompactVertex
+{
+    float x, y, z;
+    std::uint32_t color;
+};
+
+//
+// Vertex format consumed by the point and line batches of a dd::RenderInterface.
+// Glyphs are always sent as dd::DrawVertex.
+//
+enum VertexFormat
+{
+    VertexFormatDefault, // dd::DrawVertex, sent to drawPointList() and drawLineList().
+    VertexFormatCompact  // dd::CompactVertex, sent to drawPackedPointList() and drawPackedLineList().
+};
+
+//
+// Index format of the line and glyph batches of a dd::RenderInterface.
+// Points are never indexed.
+//
+enum IndexFormat
+{
+    IndexFormatNone, // Not indexed. Lines and glyphs are sent to the draw*List() methods.
+    IndexFormat16,   // std::uint16_t indexes, sent to the drawIndexed*List() methods.
+    IndexFormat32    // std::uint32_t indexes, sent to the drawIndexed*List() methods.
+};
+
 //
 // Opaque handle to a texture object.
 // Used by the debug text drawing functions.
@@ -711,6 +877,96 @@ union DrawVertex
 struct OpaqueTextureType { };
 typedef OpaqueTextureType * GlyphTextureHandle;
 
+//
+// Kind of primitive in a batch of vertexes sent to a dd::RenderInterface.
+//
+enum PrimitiveType
+{
+    PrimitivePoints, // One vertex per point.
+    PrimitiveLines,  // Two vertexes per line segment, or two indexes if indexed.
+    PrimitiveGlyphs  // Six vertexes (two triangles) per text glyph, always dd::DrawVertex. Four vertexes and six indexes if indexed.
+};
+
+//
+// Describes a batch written to memory from RenderInterface::acquireVertices(),
+// passed back to RenderInterface::commitVertices() once it is ready to draw.
+//
+struct VertexBatch
+{
+    PrimitiveType      type;
+    VertexFormat       format;       // Format of the vertexes. Glyphs are always VertexFormatDefault.
+    int                count;        // Number of vertexes written.
+    bool               depthEnabled; // Depth test flag of points and lines.
+    float              pointSize;    // Size of all points in a packed points batch. Zero otherwise.
+    GlyphTextureHandle glyphTex;     // Glyph texture, for glyph batches. Null otherwise.
+    const void *       indexes;      // Indexes into the vertexes, in the format from RenderInterface::getIndexFormat(). Null if not indexed.
+    int                indexCount;   // Number of indexes. Zero if not indexed.
+};
+
+//
+// One batch of a frame passed to RenderInterface::submitFrame().
+//
+struct DrawRange
+{
+    VertexBatch batch;        // State and counts of the batch. Its indexes pointer is always null, use indexOffset.
+    int         layer;        // Render layer of the batch, see dd::setRenderLayer().
+    std::size_t vertexOffset; // Offset in bytes of the batch's vertexes in FrameSubmission::vertexes.
+    std::size_t indexOffset;  // Offset in bytes of the batch's indexes in FrameSubmission::indexes, if indexed.
+};
+
+//
+// A whole frame of debug draws, as one vertex arena plus the ranges to draw from it.
+//
+struct FrameSubmission
+{
+    const void *      vertexes;    // Vertexes of all batches, back to back. Each batch is in its own VertexBatch::format.
+    std::size_t       vertexBytes;
+    const void *      indexes;     // Indexes of all indexed batches, in the RenderInterface::getIndexFormat() format.
+    std::size_t       indexBytes;  // Null and zero if there are none.
+    const DrawRange * ranges;      // In the order dd::flush() would draw them: by layer, then lines, points and glyphs.
+    int               numRanges;
+};
+
+//
+// Unit wireframe meshes of the shapes dd::flush() expands into lines, which a
+// dd::RenderInterface can also draw instanced (see wantsInstancedShapes()).
+//
+enum ShapeId
+{
+    ShapeSphere,      // dd::sphere() of radius 1 at the origin.
+    ShapeCone,        // dd::cone() with its apex at the origin and a base of radius 1 centered at Z = 1.
+    ShapeCircle,      // dd::circle() of radius 1 at the origin, in the XY plane, with ShapeCircleSteps steps.
+    ShapeCapsuleBody, // The sides of a dd::capsule(): circles of radius 1 at Z = 0 and Z = 1, joined by lines.
+    ShapeCapsuleCap,  // One end of a dd::capsule(): half a sphere of radius 1 at the origin, on the +Z side.
+    ShapeBox,         // dd::box() and dd::aabb() from -1 to 1 on every axis. Not the box() taking 8 points.
+    ShapeArrowHead,   // Head of a dd::arrow(): a cone with its apex at the origin, a base of radius 1 at Z = 1 and 12 steps.
+    ShapeCount
+};
+
+// Only dd::circle() calls with this many steps are queued as a ShapeCircle.
+static const int ShapeCircleSteps = 24;
+
+//
+// Line list of a unit shape mesh, passed to RenderInterface::createShapeMesh().
+//
+struct ShapeMesh
+{
+    const float * positions;   // XYZ of each vertex, two vertexes per line.
+    int           vertexCount;
+};
+
+//
+// Placement and color of a queued shape, as drawn by RenderInterface::drawInstancedShapes().
+// The transform is a 3x4 COLUMN-MAJOR matrix, i.e. the world space X, Y and Z axes
+// of the unit mesh followed by its origin. Axes are scaled, but not necessarily
+// orthogonal to each other nor of the same length (e.g. a capsule body).
+//
+struct ShapeInstance
+{
+    float         transform[12];
+    std::uint32_t color;         // Packed RGBA8, same as dd::CompactVertex.
+};
+
 // ========================================================
 // Debug Draw rendering callbacks:
 // Implementation is provided by the user so we don't
@@ -729,6 +985,14 @@ public:
     virtual void beginDraw();
     virtual void endDraw();
 
+    //
+    // Called by dd::flush() before drawing the primitives of each render layer
+    // (see dd::setRenderLayer()) that has anything queued, in increasing layer order.
+    // Renderers can override this to change states per layer, e.g. to draw a
+    // layer as an overlay. No-op by default.
+    //
+    virtual void beginLayer(int layer);
+
     //
     // Create/free the glyph bitmap texture used by the debug text drawing functions.
     // The debug renderer currently only creates one of those on startup.
@@ -751,10 +1015,160 @@ public:
     virtual void drawLineList(const DrawVertex * lines, int count, bool depthEnabled);
     virtual void drawGlyphList(const DrawVertex * glyphs, int count, GlyphTextureHandle glyphTex);
 
+    //
+    // Vertex format wanted for points and lines. Only called once by dd::initialize(),
+    // so the format is fixed for the lifetime of the context. Returns VertexFormatDefault
+    // unless overridden. If you return VertexFormatCompact, points and lines are sent
+    // to the two methods below instead of drawPointList() and drawLineList().
+    // All points in a packed batch share the same 'size'.
+    //
+    virtual VertexFormat getVertexFormat();
+    virtual void drawPackedPointList(const CompactVertex * points, int count, float size, bool depthEnabled);
+    virtual void drawPackedLineList(const CompactVertex * lines, int count, bool depthEnabled);
+
+    //
+    // Index format wanted for lines and glyphs. Only called once by dd::initialize().
+    // Returns IndexFormatNone unless overridden. Otherwise, line and glyph batches are sent
+    // to the methods below as unique vertexes plus indexes forming the same line list or
+    // triangle list, in the chosen format. Line endpoints shared by connected lines of the
+    // same color, such as box corners or sphere rings, are only written once per batch,
+    // and each glyph quad takes 4 vertexes instead of 6. With IndexFormat16, batches are
+    // limited to 65536 vertexes. Line vertexes use the format from getVertexFormat().
+    //
+    virtual IndexFormat getIndexFormat();
+    virtual void drawIndexedLineList(const DrawVertex * lines, int vertexCount, const void * indexes, int indexCount, bool depthEnabled);
+    virtual void drawPackedIndexedLineList(const CompactVertex * lines, int vertexCount, const void * indexes, int indexCount, bool depthEnabled);
+    virtual void drawIndexedGlyphList(const DrawVertex * glyphs, int vertexCount, const void * indexes, int indexCount, GlyphTextureHandle glyphTex);
+
+    //
+    // Batch sizes in vertexes. Only called once by dd::initialize(). getPreferredBatchSize()
+    // overrides the vertexBufferSize of the dd::ContextConfig, so a renderer with a large
+    // vertex ring can take a whole frame of debug lines in a few calls, while getMaxBatchSize()
+    // is the most vertexes the renderer can take in a single draw*List() or commitVertices()
+    // call. The context's vertex buffer and the points where batches are broken follow the
+    // resulting size. Both return zero by default, meaning no preference and no limit.
+    // dd::initialize() fails if the max size is less than 8.
+    //
+    virtual int getPreferredBatchSize();
+    virtual int getMaxBatchSize();
+
+    //
+    // Optional zero-copy submission. Before writing a batch, the library asks for writable
+    // memory with room for 'maxCount' vertexes of the batch's format (dd::CompactVertex for
+    // points and lines if getVertexFormat() returned VertexFormatCompact, dd::DrawVertex
+    // otherwise), such as a mapped GPU buffer. Vertexes are then written straight into it,
+    // and once the batch is done commitVertices() is called instead of the draw*List()
+    // method for that batch. No other method is called between the two. Indexes of
+    // indexed batches are kept by the library and passed to commitVertices() in the batch.
+    //
+    // acquireVertices() returns null by default, in which case the batch is written to the
+    // context's own vertex buffer and sent to the draw*List() methods above, as usual.
+    // 'maxCount' is the size of the vertex buffer (see getPreferredBatchSize()).
+    //
+    virtual void * acquireVertices(PrimitiveType type, int maxCount);
+    virtual void commitVertices(const VertexBatch & batch);
+
+    //
+    // Optional single call frame submission. If wantsFrameSubmission() returns true (only called
+    // once by dd::initialize()), dd::flush() gathers all the vertexes of the frame into one arena
+    // and calls submitFrame() once, instead of beginDraw(), beginLayer(), the batch methods above
+    // and endDraw(). The renderer can then upload the arena with a single copy and order the
+    // ranges as it sees fit. Consecutive non-indexed batches with the same state are merged into
+    // one range, so ranges can be larger than getMaxBatchSize(). The memory is owned by the
+    // context and only valid during the call. dd::flushSnapshot() submits snapshots this way too.
+    // wantsFrameSubmission() returns false by default.
+    //
+    virtual bool wantsFrameSubmission();
+    virtual void submitFrame(const FrameSubmission & frame);
+
+    //
+    // Optional instanced shapes. dd::sphere(), dd::capsule(), dd::box(), dd::aabb(), the head of
+    // dd::arrow(), dd::cone() with a zero 'apexRadius' and dd::circle() with ShapeCircleSteps
+    // steps always queue one dd::ShapeInstance per shape (three for a capsule) instead of their
+    // lines, which dd::flush() normally expands along with the other lines. If wantsInstancedShapes()
+    // returns true (only called once by dd::initialize()), createShapeMesh() is called once per
+    // dd::ShapeId right away, with the unit mesh of that shape, and dd::flush() sends the queued
+    // shapes to drawInstancedShapes() instead, after the lines of each render layer, in batches of
+    // the same shape. Shapes don't count against the vertex budget of a budgeted dd::flush(). Mesh
+    // and instance memory is owned by the context and only valid during the call. Not used by
+    // contexts with frame snapshots, nor if wantsFrameSubmission() returns true, as their
+    // frames are made of vertexes only. wantsInstancedShapes() returns false by default.
+    //
+    virtual bool wantsInstancedShapes();
+    virtual void createShapeMesh(ShapeId shapeId, const ShapeMesh & mesh);
+    virtual void drawInstancedShapes(ShapeId shapeId, const ShapeInstance * instances, int count, bool depthEnabled);
+
     // User defined cleanup. Nothing by default.
     virtual ~RenderInterface() = 0;
 };
 
+// ========================================================
+// Per context memory allocation callbacks:
+// ========================================================
+
+//
+// What an allocation made through a dd::Allocator is for.
+//
+enum AllocTag
+{
+    AllocTagContext,      // The context data. One allocation, freed by dd::shutdown().
+    AllocTagVertexBuffer, // The vertex buffer used to batch draws, plus the index buffer if indexed and the instance buffer if instanced. Freed by dd::shutdown().
+    AllocTagQueue,        // Chunks and bucket nodes of the draw queues. Allocated as needed, pooled for reuse.
+    AllocTagStrings,      // The text arena of the debug strings. Reallocated if it has to grow.
+    AllocTagFont,         // Temporary buffer for the decompressed glyph bitmap, freed right after use.
+    AllocTagSnapshots,    // Frame snapshots of dd::endFrame() and frames for RenderInterface::submitFrame(), if used. Grown as needed.
+    AllocTagShapeMeshes,  // Temporary buffer for the unit meshes given to RenderInterface::createShapeMesh(), freed right after use.
+    AllocTagCount
+};
+
+class Allocator
+{
+public:
+
+    //
+    // Allocate 'sizeBytes' aligned to at least 'alignment', which is always a power of two.
+    // Returning null is handled as out of memory: dd::initialize() fails, or the draw is dropped.
+    // The defaults use DD_MALLOC/DD_MFREE, assuming those are aligned for any standard type.
+    //
+    // Calls come from whichever thread calls into the context the memory belongs to, so
+    // an allocator used by a single context doesn't have to be thread safe. 'sizeBytes'
+    // and 'tag' passed to deallocate() are the same given to allocate() for that memory.
+    //
+    virtual void * allocate(std::size_t sizeBytes, std::size_t alignment, AllocTag tag);
+    virtual void deallocate(void * ptr, std::size_t sizeBytes, AllocTag tag);
+
+    // User defined cleanup. Nothing by default.
+    virtual ~Allocator();
+};
+
+// ========================================================
+// Parallel flush callbacks:
+// ========================================================
+
+//
+// Task function run by a dd::TaskScheduler. 'index' is in the [0, count) range
+// given to TaskScheduler::parallelFor(), 'userData' is passed through as is.
+//
+typedef void (*TaskFunc)(void * userData, int index);
+
+class TaskScheduler
+{
+public:
+
+    //
+    // Run task(userData, i) for every i in [0, count), on as many worker threads as
+    // desired, and only return once all of them have completed. Called by dd::flush()
+    // from the thread flushing the context, to expand queued points and lines into
+    // disjoint parts of the current vertex batch. Tasks don't call into the library
+    // or the dd::RenderInterface, so they need no synchronization among themselves.
+    // The default runs the tasks one after the other on the calling thread.
+    //
+    virtual void parallelFor(int count, TaskFunc task, void * userData);
+
+    // User defined cleanup. Nothing by default.
+    virtual ~TaskScheduler();
+};
+
 // ========================================================
 // Housekeeping functions:
 // ========================================================
@@ -765,7 +1179,120 @@ enum FlushFlags
     FlushPoints = 1 << 1,
     FlushLines  = 1 << 2,
     FlushText   = 1 << 3,
-    FlushAll    = (FlushPoints | FlushLines | FlushText)
+    FlushAll    = (FlushPoints | FlushLines | FlushText),
+
+    // Not part of FlushAll. Skips the timed points, lines and shapes that are entirely outside
+    // the planes from dd::setCullingPlanes(). They stay queued, so they are drawn again
+    // once back in view. Points are tested by their center, regardless of size, and shapes
+    // by the oriented box around them.
+    FlushCullTimed = 1 << 4
+};
+
+// Limits for a budgeted dd::flush(), which only draws a slice of the timed points and lines
+// per call and resumes where it stopped on the next call. Zero means no limit. Text is never limited.
+struct FlushBudget
+{
+    int          maxVertexes;     // Max point and line vertexes to draw, shared by both in proportion to what is queued.
+                                  // Shapes expanded into lines count the vertexes of their lines.
+    std::int64_t maxMicroseconds; // Max CPU time to spend expanding points, lines and shapes, checked once per queue chunk,
+                                  // or once per shape for shapes expanded into lines.
+    bool         transientFirst;  // If set, draws with no duration are always drawn in full, and only the rest of the
+                                  // budget goes to timed draws. Otherwise they count against the budget like the timed
+                                  // ones, and those that don't fit are dropped without being drawn.
+
+    FlushBudget()
+        : maxVertexes(0)
+        , maxMicroseconds(0)
+        , transientFirst(true)
+    { }
+};
+
+// Runtime sizes of the internal queues and buffers of a context.
+// A default constructed config uses the DEBUG_DRAW_MAX_*,
+// DEBUG_DRAW_VERTEX_BUFFER_SIZE and DEBUG_DRAW_TEXT_ARENA_SIZE values,
+// so you only have to change the fields you care about before
+// calling dd::initialize().
+struct ContextConfig
+{
+    int maxStrings;       // Max debug strings (screen text + projected labels) queued at any given time.
+    int maxPoints;        // Max debug points queued at any given time.
+    int maxLines;         // Max debug lines queued at any given time (shapes not counted in maxShapes are made of lines).
+    int maxShapes;        // Max shapes (spheres, boxes, etc) queued at any given time. See RenderInterface::wantsInstancedShapes().
+    int vertexBufferSize; // Size in dd::DrawVertex elements of the buffer used to batch draws. Must be at least 8. The renderer can override it.
+    int textArenaSize;    // Bytes of text the queued debug strings can hold, counting a null terminator per string.
+
+    // If set, the max* sizes above are only the initial reservation and the queues
+    // keep growing in chunks of DEBUG_DRAW_QUEUE_CHUNK_SIZE elements instead of
+    // dropping draws once full. Queued elements are never moved when a queue grows.
+    // The text arena also doubles in size whenever it runs out of space.
+    bool growableQueues;
+
+    // Allocator for all the memory of the context. Must remain valid until after
+    // dd::shutdown() is called. If null, DD_MALLOC and DD_MFREE are used instead.
+    Allocator * allocator;
+
+    // If set, dd::flush() splits the vertex expansion of each point and line batch
+    // into tasks run through this scheduler. Draw calls are still issued by the
+    // flushing thread, in the same order. Must remain valid until after dd::shutdown().
+    // Only worth it with a vertexBufferSize large enough to hold several queue chunks.
+    TaskScheduler * taskScheduler;
+
+    // If set, the context keeps three frame snapshots for dd::endFrame() and
+    // dd::flushSnapshot(), so a render thread can draw the last finished frame
+    // while the owner of the context records the next one.
+    bool frameSnapshots;
+
+    ContextConfig()
+        : maxStrings(DEBUG_DRAW_MAX_STRINGS)
+        , maxPoints(DEBUG_DRAW_MAX_POINTS)
+        , maxLines(DEBUG_DRAW_MAX_LINES)
+        , maxShapes(DEBUG_DRAW_MAX_SHAPES)
+        , vertexBufferSize(DEBUG_DRAW_VERTEX_BUFFER_SIZE)
+        , textArenaSize(DEBUG_DRAW_TEXT_ARENA_SIZE)
+        , growableQueues(false)
+        , allocator(nullptr)
+        , taskScheduler(nullptr)
+        , frameSnapshots(false)
+    { }
+};
+
+// Memory used by one of the internal draw queues of a context.
+struct QueueMemoryStats
+{
+    std::size_t reservedBytes;  // Bytes allocated for the queue, including chunks kept in its pools for reuse.
+    std::size_t usedBytes;      // Bytes of the chunks currently holding queued elements.
+    int         count;          // Number of elements currently queued.
+    int         highWaterCount; // Max number of elements queued at once since dd::initialize().
+};
+
+// Memory used by a context, as reported by dd::getMemoryStats().
+struct MemoryStats
+{
+    QueueMemoryStats strings;
+    QueueMemoryStats points;
+    QueueMemoryStats lines;
+    QueueMemoryStats shapes; // Shapes queued whole, see RenderInterface::wantsInstancedShapes().
+
+    std::size_t contextBytes;            // Context data plus the vertex buffer, allocated once by dd::initialize().
+    std::size_t vertexBufferBytes;       // Part of contextBytes used by the vertex buffer and the index buffer, if any.
+    std::size_t textArenaReservedBytes;  // Both buffers of the debug string text arena.
+    std::size_t textArenaUsedBytes;      // Bytes of text currently queued.
+    std::size_t textArenaHighWaterBytes; // Max bytes of text queued at once since dd::initialize().
+    std::size_t snapshotReservedBytes;   // Frame snapshots of dd::endFrame() and the frame for RenderInterface::submitFrame(), if used.
+
+    std::size_t totalReservedBytes;      // Everything the context currently has allocated.
+    std::size_t totalUsedBytes;          // Part of totalReservedBytes holding queued draws, plus contextBytes.
+};
+
+// Shapes rejected by the culling planes since the last dd::setCullingPlanes(). See dd::getCullStats().
+struct CullStats
+{
+    int spheres;
+    int boxes;    // Both dd::box() overloads.
+    int aabbs;
+    int capsules;
+    int cones;
+    int frustums;
 };
 
 // Initialize with the user-supplied renderer interface.
@@ -774,6 +1301,10 @@ enum FlushFlags
 // can still be safely called.
 bool initialize(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle * outCtx,) RenderInterface * renderer);
 
+// Same as above, but the queue and vertex buffer sizes are taken from 'config'
+// instead of the compile-time defaults. Fails if any of the sizes are invalid.
+bool initialize(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle * outCtx,) RenderInterface * renderer, const ContextConfig & config);
+
 // After this is called, it is safe to dispose the dd::RenderInterface instance
 // you passed to dd::initialize(). Shutdown will also attempt to free the glyph texture.
 void shutdown(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx));
@@ -788,6 +1319,44 @@ bool hasPendingDraws(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx));
 // This is not normally called. To draw stuff, call dd::flush() instead.
 void clear(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx));
 
+// Fills 'outStats' with the memory currently reserved and used by the context.
+// Returns false and leaves 'outStats' untouched if the context is not initialized.
+bool getMemoryStats(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) MemoryStats * outStats);
+
+// Frees the queue chunks and text arena space that are not in use, except for the
+// initial reservation made from the dd::ContextConfig. Useful after a spike of debug
+// draws, such as a one-off visualization, if the queues are growable. Queued draws
+// are not affected.
+void trim(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx));
+
+// Selects the render layer subsequent draws are queued in, from 0 to DEBUG_DRAW_RENDER_LAYERS-1.
+// dd::flush() draws the layers in increasing order, calling RenderInterface::beginLayer() before
+// each one. Layer 0 is the default. Out of range values are ignored.
+void setRenderLayer(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) int layer);
+
+// Returns the layer set by dd::setRenderLayer(), or 0 if the context is not initialized.
+int getRenderLayer(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx));
+
+// Sets the camera that the queued spheres, cones, capsules and circles are tessellated for
+// when dd::flush() expands them into lines. Each one then gets from 4 to 48 steps around,
+// the fewest that keep its lines within DEBUG_DRAW_LOD_PIXEL_ERROR pixels of its outline,
+// instead of the fixed steps. 'vpMatrix' is the view * projection matrix and 'sw'/'sh' the
+// viewport size in pixels; a zero size goes back to the fixed steps. The view is kept until
+// changed. Shapes drawn by RenderInterface::drawInstancedShapes() always use the fixed meshes.
+void setView(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) ddMat4x4_In vpMatrix, int sw, int sh);
+
+// Sets six planes (A, B, C, D) that dd::sphere(), dd::box(), dd::aabb(), dd::capsule(), dd::cone()
+// and dd::frustum() test their bounding volume against before generating any lines. A shape
+// entirely on the negative side of any plane (A*x + B*y + C*z + D < 0) is dropped and counted
+// in the dd::CullStats, which this call resets. The planes don't need to be normalized. Only
+// draws with a zero duration are culled, since timed draws may come into view as the camera
+// moves. Pass null to turn culling off.
+void setCullingPlanes(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const float planes[6][4]);
+
+// Fills 'outStats' with the shapes culled since the last dd::setCullingPlanes().
+// Returns false and leaves 'outStats' untouched if the context is not initialized.
+bool getCullStats(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) CullStats * outStats);
+
 // Actually calls the dd::RenderInterface to consume the debug draw queues.
 // Objects that have expired their lifetimes get removed. Pass the current
 // application time in milliseconds to remove timed objects that have expired.
@@ -796,6 +1365,35 @@ void flush(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,)
            std::int64_t currTimeMillis = 0,
            std::uint32_t flags = FlushAll);
 
+// Same as above, but only draws as many points and lines as the budget allows. Shapes expanded into
+// lines are charged the lines they take, and timed ones share the slice of the timed lines. The timed
+// draws are drawn a slice at a time, rotating through all of them over successive calls, so a large
+// set of long-lived draws is spread over several frames instead of being drawn in full every frame.
+// A timed shape starting a slice is drawn even if its lines alone go over the budget, so it can't
+// stall the rotation.
+// Shapes drawn instanced are not budgeted. Expired objects are still removed on every call.
+void flush(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,)
+           std::int64_t currTimeMillis,
+           const FlushBudget & budget,
+           std::uint32_t flags = FlushAll);
+
+// Frame snapshots, for contexts initialized with ContextConfig::frameSnapshots.
+// dd::endFrame() does the same work as a dd::flush(), but records the draws into a
+// snapshot instead of calling the dd::RenderInterface, then publishes it as the
+// latest finished frame. dd::flushSnapshot() sends the latest published snapshot
+// to the renderer, and can be called from another thread at its own pace, with no
+// locks on either side. If it runs again before a new frame is published, the same
+// snapshot is drawn again. Frames published in between two calls are skipped, so
+// their draws with no lifetime never reach the screen.
+//
+// Call dd::endFrame() instead of dd::flush() on a context using snapshots, from
+// the thread that queues the draws. Only dd::flushSnapshot() may be called from
+// the render thread, and never after dd::shutdown() has started. Contexts of
+// DEBUG_DRAW_PER_THREAD_CONTEXT can't be reached from another thread, so there
+// both calls have to come from the owning thread.
+void endFrame(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) std::int64_t currTimeMillis = 0);
+void flushSnapshot(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx));
+
 } // namespace dd
 
 // ================== End of header file ==================
@@ -816,11 +1414,29 @@ void flush(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,)
     #define DD_MFREE  std::free
 #endif // DD_MALLOC
 
+#include <atomic>  // Frame snapshot handoff.
+#include <chrono>  // Time budget of dd::flush().
+#include <cstring> // std::memcpy
+
 #if DEBUG_DRAW_USE_STD_MATH
     #include <math.h>
     #include <float.h>
 #endif // DEBUG_DRAW_USE_STD_MATH
 
+// Vertex expansion kernel, selected from the instruction sets the compiler targets.
+#if !defined(DEBUG_DRAW_NO_SIMD) && !defined(DEBUG_DRAW_QUANTIZED_POSITIONS)
+    #if defined(__AVX2__)
+        #include <immintrin.h>
+        #define DD_SIMD_AVX2 1
+    #elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+        #include <emmintrin.h>
+        #define DD_SIMD_SSE2 1
+    #elif defined(__ARM_NEON) && defined(__aarch64__)
+        #include <arm_neon.h>
+        #define DD_SIMD_NEON 1
+    #endif // Instruction sets
+#endif // !DEBUG_DRAW_NO_SIMD && !DEBUG_DRAW_QUANTIZED_POSITIONS
+
 namespace dd
 {
 
@@ -851,6 +1467,30 @@ static inline int arrayLength(const T (&)[Size])
     return Size;
 }
 
+// Allocations go through the context's dd::Allocator if it has one, DD_MALLOC/DD_MFREE otherwise.
+static inline void * allocMemory(Allocator * allocator, const std::size_t sizeBytes,
+                                 const std::size_t alignment, const AllocTag tag)
+{
+    return (allocator != nullptr) ? allocator->allocate(sizeBytes, alignment, tag) : DD_MALLOC(sizeBytes);
+}
+
+static inline void freeMemory(Allocator * allocator, void * ptr, const std::size_t sizeBytes, const AllocTag tag)
+{
+    if (ptr == nullptr)
+    {
+        return;
+    }
+
+    if (allocator != nullptr)
+    {
+        allocator->deallocate(ptr, sizeBytes, tag);
+    }
+    else
+    {
+        DD_MFREE(ptr);
+    }
+}
+
 // ========================================================
 // Built-in color constants:
 // ========================================================
@@ -1779,7 +2419,7 @@ static int lzwDecompress(const void * compressedData, int compressedSizeBytes,
 static inline const std::uint8_t * getRawFontBitmapData() { return s_fontMonoid18Bitmap;  }
 static inline const FontCharSet  & getFontCharSet()       { return s_fontMonoid18CharSet; }
 
-static std::uint8_t * decompressFontBitmap()
+static std::uint8_t * decompressFontBitmap(Allocator * allocator)
 {
     const std::uint32_t * compressedData = reinterpret_cast<const std::uint32_t *>(getRawFontBitmapData());
 
@@ -1790,7 +2430,7 @@ static std::uint8_t * decompressFontBitmap()
 
     // Allocate the decompression buffer:
     const int uncompressedSizeBytes = getFontCharSet().bitmapDecompressSize;
-    std::uint8_t * uncompressedData = static_cast<std::uint8_t *>(DD_MALLOC(uncompressedSizeBytes));
+    std::uint8_t * uncompressedData = static_cast<std::uint8_t *>(allocMemory(allocator, uncompressedSizeBytes, 1, AllocTagFont));
 
     // Out of memory? Font rendering will be disable.
     if (uncompressedData == nullptr)
@@ -1808,11 +2448,11 @@ static std::uint8_t * decompressFontBitmap()
     // Unexpected decompression size? Probably a data mismatch in the font-tool.
     if (bytesDecoded != uncompressedSizeBytes)
     {
-        DD_MFREE(uncompressedData);
+        freeMemory(allocator, uncompressedData, uncompressedSizeBytes, AllocTagFont);
         return nullptr;
     }
 
-    // Must later free with DD_MFREE().
+    // Must later free with freeMemory(), size is getFontCharSet().bitmapDecompressSize.
     return uncompressedData;
 }
 
@@ -1822,105 +2462,721 @@ static std::uint8_t * decompressFontBitmap()
 
 struct DebugString
 {
-    std::int64_t expiryDateMillis;
     ddVec3       color;
     float        posX;
     float        posY;
     float        scaling;
-    ddStr        text;
+    int          textOffset; // Start of the null-terminated text in the context's text arena.
+    int          textLength; // Length of the text, not counting the null terminator.
     bool         centered;
 };
 
-struct DebugPoint
+//
+// Queues are stored as linked lists of fixed-size chunks, so they can grow without
+// reallocating or copying the elements already queued. Chunks that get emptied when
+// expired elements are removed go back to a free-list, to be reused by the next draws.
+//
+// Each queue keeps two kinds of storage. Elements with no duration only live until the
+// next flush, so they go into a transient chunk list that is dropped as a whole after
+// drawing and never has its expiry dates checked. Timed elements are grouped in buckets
+// by expiry date, each bucket covering a window of time and holding its own chunks.
+// Buckets form a hierarchical timing wheel: dates within DEBUG_DRAW_EXPIRY_WINDOW_MILLIS
+// of the current time get the finest windows, and each level further out gets windows
+// ExpiryLevelRatio times wider, so only a few buckets are ever open, no matter how
+// spread out the durations are. A flush returns the buckets whose elements have all
+// expired to the pools whole, without looking at their elements. Once the current time
+// reaches the window of a coarser bucket, its elements are moved to finer buckets, so
+// each element is only moved a few times in its whole life, never on every flush.
+//
+// Transient chunks have no room for expiry dates at all, so the two kinds of storage
+// use different chunk types, each with its own pool.
+//
+// The transient storage and every bucket are further split in one chunk list per
+// render state, i.e. render layer and depth test on/off (see getQueuePartition()).
+// Elements are sorted by state as they are pushed, so the flush can draw each
+// state in a single linear pass, without filtering elements.
+//
+// Points and lines are stored as structures of arrays inside each chunk, so the
+// passes that only need one field (e.g. expiry or depth test) don't have to drag
+// the whole element through the cache, and positions are contiguous floats.
+// Their colors are kept packed, the way dd::CompactVertex expects them.
+//
+
+struct DebugStringArray
 {
-    std::int64_t expiryDateMillis;
-    ddVec3       position;
-    ddVec3       color;
-    float        size;
-    bool         depthEnabled;
+    DebugString strings[DEBUG_DRAW_QUEUE_CHUNK_SIZE];
 };
 
-struct DebugLine
+struct DebugPointArrays
 {
-    std::int64_t expiryDateMillis;
-    ddVec3       posFrom;
-    ddVec3       posTo;
-    ddVec3       color;
-    bool         depthEnabled;
+    #ifdef DEBUG_DRAW_QUANTIZED_POSITIONS
+    float         origin[3];                                 // Set by the first point pushed to the chunk.
+    std::int16_t  positions[DEBUG_DRAW_QUEUE_CHUNK_SIZE][3]; // Offsets from 'origin' in DEBUG_DRAW_QUANTIZATION_STEP units.
+    std::uint8_t  slotKinds[DEBUG_DRAW_QUEUE_CHUNK_SIZE];    // How each slot of 'positions' is used. See SlotQuantized.
+    #else // !DEBUG_DRAW_QUANTIZED_POSITIONS
+    float         positions[DEBUG_DRAW_QUEUE_CHUNK_SIZE][3];
+    #endif // DEBUG_DRAW_QUANTIZED_POSITIONS
+    std::uint32_t colors[DEBUG_DRAW_QUEUE_CHUNK_SIZE]; // Packed RGBA8, same as dd::CompactVertex.
+    float         sizes[DEBUG_DRAW_QUEUE_CHUNK_SIZE];
 };
 
-struct InternalContext DD_EXPLICIT_CONTEXT_ONLY(: public OpaqueContextType)
+struct DebugLineArrays
 {
-    int                vertexBufferUsed;
-    int                debugStringsCount;
-    int                debugPointsCount;
-    int                debugLinesCount;
-    std::int64_t       currentTimeMillis;                           // Latest time value (in milliseconds) from dd::flush().
-    GlyphTextureHandle glyphTexHandle;                              // Our built-in glyph bitmap. If kept null, no text is rendered.
-    RenderInterface *  renderInterface;                             // Ref to the external renderer. Can be null for a no-op debug draw.
-    DrawVertex         vertexBuffer[DEBUG_DRAW_VERTEX_BUFFER_SIZE]; // Vertex buffer we use to expand the lines/points before calling on RenderInterface.
-    DebugString        debugStrings[DEBUG_DRAW_MAX_STRINGS];        // Debug strings queue (2D screen-space strings + 3D projected labels).
-    DebugPoint         debugPoints[DEBUG_DRAW_MAX_POINTS];          // 3D debug points queue.
-    DebugLine          debugLines[DEBUG_DRAW_MAX_LINES];            // 3D debug lines queue.
-
-    InternalContext(RenderInterface * renderer)
-        : vertexBufferUsed(0)
-        , debugStringsCount(0)
-        , debugPointsCount(0)
-        , debugLinesCount(0)
-        , currentTimeMillis(0)
-        , glyphTexHandle(nullptr)
-        , renderInterface(renderer)
-    { }
+    #ifdef DEBUG_DRAW_QUANTIZED_POSITIONS
+    float         origin[3];                                 // Midpoint of the first line pushed to the chunk.
+    std::int16_t  positions[DEBUG_DRAW_QUEUE_CHUNK_SIZE][6]; // 'from' XYZ followed by 'to' XYZ, as offsets from 'origin'.
+    std::uint8_t  slotKinds[DEBUG_DRAW_QUEUE_CHUNK_SIZE];    // How each slot of 'positions' is used. See SlotQuantized.
+    #else // !DEBUG_DRAW_QUANTIZED_POSITIONS
+    float         positions[DEBUG_DRAW_QUEUE_CHUNK_SIZE][6]; // 'from' XYZ followed by 'to' XYZ.
+    #endif // DEBUG_DRAW_QUANTIZED_POSITIONS
+    std::uint32_t colors[DEBUG_DRAW_QUEUE_CHUNK_SIZE]; // Packed RGBA8, same as dd::CompactVertex.
 };
 
-// ========================================================
-// Library context mode selection:
-// ========================================================
+// All shapes share a queue. They are sorted by shape when drawn instanced.
+// Transforms are always stored as floats, even with quantized positions.
+struct DebugShapeArrays
+{
+    ShapeInstance instances[DEBUG_DRAW_QUEUE_CHUNK_SIZE];
+    std::uint8_t  shapeIds[DEBUG_DRAW_QUEUE_CHUNK_SIZE]; // dd::ShapeId of each instance.
+};
 
-#if (defined(DEBUG_DRAW_PER_THREAD_CONTEXT) && defined(DEBUG_DRAW_EXPLICIT_CONTEXT))
-    #error "DEBUG_DRAW_PER_THREAD_CONTEXT and DEBUG_DRAW_EXPLICIT_CONTEXT are mutually exclusive!"
-#endif // DEBUG_DRAW_PER_THREAD_CONTEXT && DEBUG_DRAW_EXPLICIT_CONTEXT
+// Chunk of transient elements, which need no expiry date.
+template<typename ArraysType>
+struct DebugChunk
+{
+    DebugChunk * next;
+    int          count;       // Slots used.
+    int          numElements; // Elements in the used slots. Fewer than 'count' if some take two slots.
+    ArraysType   elements;
 
-#if defined(DEBUG_DRAW_EXPLICIT_CONTEXT)
-    //
-    // Explicit context passed as argument
-    //
-    #define DD_CONTEXT static_cast<InternalContext *>(ctx)
-#elif defined(DEBUG_DRAW_PER_THREAD_CONTEXT)
-    //
-    // Per-thread global context (MT safe)
-    //
-    #if defined(__GNUC__) || defined(__clang__) // GCC/Clang
-        #define DD_THREAD_LOCAL static __thread
-    #elif defined(_MSC_VER) // Visual Studio
-        #define DD_THREAD_LOCAL static __declspec(thread)
-    #else // Try C++11 thread_local
-        #if DEBUG_DRAW_CXX11_SUPPORTED
-            #define DD_THREAD_LOCAL static thread_local
-        #else // !DEBUG_DRAW_CXX11_SUPPORTED
-            #error "Unsupported compiler - unknown TLS model"
-        #endif // DEBUG_DRAW_CXX11_SUPPORTED
-    #endif // TLS model
-    DD_THREAD_LOCAL InternalContext * s_threadContext = nullptr;
-    #define DD_CONTEXT s_threadContext
-    #undef DD_THREAD_LOCAL
-#else // Debug Draw context selection
-    //
-    // Global static context (single threaded operation)
-    //
-    static InternalContext * s_globalContext = nullptr;
-    #define DD_CONTEXT s_globalContext
-#endif // Debug Draw context selection
+    DebugChunk() : next(nullptr), count(0), numElements(0) { }
+};
 
-// ========================================================
+// Chunk of timed elements, kept in an expiry bucket.
+template<typename ArraysType>
+struct TimedDebugChunk
+{
+    TimedDebugChunk * next;
+    int               count;       // Slots used.
+    int               numElements; // Elements in the used slots. Fewer than 'count' if some take two slots.
+    ArraysType        elements;
+    std::int64_t      expiryDateMillis[DEBUG_DRAW_QUEUE_CHUNK_SIZE];
 
-#if DEBUG_DRAW_USE_STD_MATH
+    TimedDebugChunk() : next(nullptr), count(0), numElements(0) { }
+};
 
-static inline float floatAbs(float x)       { return fabsf(x); }
-static inline float floatSin(float radians) { return sinf(radians); }
-static inline float floatCos(float radians) { return cosf(radians); }
-static inline float floatInvSqrt(float x)   { return (1.0f / sqrtf(x)); }
+template<typename ChunkType>
+struct DebugChunkList
+{
+    ChunkType * head;  // First chunk in draw order. Null if the list is empty.
+    ChunkType * tail;  // Last chunk, where new elements are appended.
+    int         count; // Total elements in all chunks of the list.
+};
+
+// Every render layer has a partition for depth tested elements followed by one
+// for the elements that ignore depth. Strings always use the latter.
+static const int NumQueuePartitions = DEBUG_DRAW_RENDER_LAYERS * 2;
+
+static inline int getQueuePartition(const int layer, const bool depthEnabled)
+{
+    return (layer * 2) + (depthEnabled ? 0 : 1);
+}
+
+// Windows of expiry dates at level N are ExpiryLevelRatio^N times as wide as
+// DEBUG_DRAW_EXPIRY_WINDOW_MILLIS, and aligned to their own width, so each window
+// is split in ExpiryLevelRatio windows of the level below. With the default 16ms,
+// the top level has windows over 9 hours wide.
+static const int ExpiryLevelShift = 3;
+static const int ExpiryLevelRatio = 1 << ExpiryLevelShift;
+static const int NumExpiryLevels  = 8;
+
+// Timed elements expiring within a window of time.
+template<typename ChunkType>
+struct DebugBucket
+{
+    DebugBucket *             next;             // Next bucket in expiry order.
+    std::int64_t              windowStart;      // Earliest expiry date of the window.
+    std::int64_t              windowEnd;        // Latest expiry date of the window.
+    std::int64_t              lastExpiryMillis; // Latest expiry date of the elements in the bucket.
+    int                       level;            // Level of the window. Zero for the finest ones.
+    int                       count;            // Total elements in all partitions.
+    DebugChunkList<ChunkType> chunks[NumQueuePartitions]; // Elements expiring within the window, by partition.
+};
+
+template<typename ArraysType>
+struct DebugQueue
+{
+    typedef DebugChunk<ArraysType>      Chunk;
+    typedef TimedDebugChunk<ArraysType> TimedChunk;
+    typedef DebugBucket<TimedChunk>     Bucket;
+
+    DebugChunkList<Chunk> transient[NumQueuePartitions];       // Elements with no duration, all dropped after the next flush.
+    int                   transientCount;                      // Total elements in all the transient lists.
+    int                   partitionCounts[NumQueuePartitions]; // Elements in each partition, transient and timed.
+    Bucket *              buckets;         // Timed elements, sorted by ascending expiry window. Null if none.
+    Bucket *              lastBucket;      // Bucket that got the latest timed push, tried first by the next one.
+    Bucket *              freeBuckets;     // Pool of unused buckets, linked by their 'next' pointers.
+    Chunk *               freeChunks;      // Pool of unused transient chunks.
+    TimedChunk *          freeTimedChunks; // Pool of unused timed chunks.
+    int                   count;           // Total elements queued, transient and timed.
+    int                   capacity;        // Max elements queued. Only enforced if the queue is not growable.
+    int                   highWaterCount;  // Max value 'count' ever reached.
+    int                   numChunks;       // Transient chunks allocated, used or pooled.
+    int                   numTimedChunks;  // Timed chunks allocated, used or pooled.
+    int                   numBuckets;      // Buckets allocated, used or pooled.
+    int                   reservedChunks;  // Transient chunks allocated up front, which dd::trim() keeps.
+    int                   drawCursor;      // Timed element the next budgeted dd::flush() starts from, counting in draw order.
+    bool                  growable;        // If set, allocates more chunks once the pools run dry.
+    Allocator *           allocator;       // From the dd::ContextConfig. Null to use DD_MALLOC/DD_MFREE.
+
+    DebugQueue(const int maxElements, const bool canGrow, Allocator * queueAllocator)
+        : transient()
+        , transientCount(0)
+        , partitionCounts()
+        , buckets(nullptr)
+        , lastBucket(nullptr)
+        , freeBuckets(nullptr)
+        , freeChunks(nullptr)
+        , freeTimedChunks(nullptr)
+        , count(0)
+        , capacity(maxElements)
+        , highWaterCount(0)
+        , numChunks(0)
+        , numTimedChunks(0)
+        , numBuckets(0)
+        , reservedChunks(0)
+        , drawCursor(0)
+        , growable(canGrow)
+        , allocator(queueAllocator)
+    { }
+};
+
+// Remembers where recently written line vertexes are in the current batch, so indexed
+// batches can refer back to them instead of writing the same vertex again.
+struct VertexCacheEntry
+{
+    float         x, y, z;
+    std::uint32_t color;
+    int           index; // Index of the vertex in the batch, or -1 if the entry is empty.
+};
+
+static const int VertexCacheSize = 64; // Must be a power of two.
+
+// A run of queued points or lines to expand into a part of the current vertex batch.
+// Only recorded if the context has a dd::TaskScheduler, and run when the batch is flushed.
+struct VertexExpansionJob
+{
+    PrimitiveType  type;     // PrimitivePoints or PrimitiveLines.
+    const void *   elements; // The DebugPointArrays or DebugLineArrays of a queue chunk.
+    int            first;    // First element of the run.
+    int            count;    // Elements in the run.
+    DrawVertex *   dest;     // Where in the vertex batch the run goes.
+};
+
+static const int MaxVertexExpansionJobs = 64;
+
+// Instances of each shape gathered by dd::flush() before a RenderInterface::drawInstancedShapes() call.
+static const int ShapeBatchSize = 256;
+
+// Which elements of a queue the current dd::flush() draws. Timed elements are counted
+// in draw order: by layer, then by depth state, then by expiry bucket.
+struct FlushSlice
+{
+    int transientLeft; // Transient elements that can still be drawn.
+    int timedFirst;    // First timed element to draw.
+    int timedLast;     // One past the last timed element to draw.
+    int timedSeen;     // Timed elements walked past so far.
+    int timedDrawn;    // Timed elements drawn so far.
+
+    bool transientTimeLimited; // Set if transient elements also count against the time budget.
+};
+
+// Growable byte buffer of a frame snapshot.
+struct SnapshotBuffer
+{
+    unsigned char * data;
+    std::size_t     used;
+    std::size_t     capacity;
+};
+
+struct FrameSnapshot
+{
+    SnapshotBuffer ranges;      // dd::DrawRanges of the recorded batches, in draw order.
+    SnapshotBuffer vertexes;    // dd::DrawVertex or dd::CompactVertex data of all batches.
+    SnapshotBuffer indexes;     // Index data of the indexed batches.
+};
+
+// Triple buffered frame snapshots. dd::endFrame() records into the back frame and swaps it with
+// 'latest', dd::flushSnapshot() swaps 'latest' with the front frame if a new one was published.
+static const int SnapshotIndexMask = 3;
+static const int SnapshotNewBit    = 4;
+
+struct SnapshotState
+{
+    FrameSnapshot     frames[3];
+    std::atomic<int>  latest;     // Index of the latest published frame, plus SnapshotNewBit if not yet drawn.
+    int               backIndex;  // Only accessed by dd::endFrame().
+    int               frontIndex; // Only accessed by dd::flushSnapshot().
+    RenderInterface * renderer;   // The context's renderer, which dd::endFrame() temporarily replaces.
+
+    explicit SnapshotState(RenderInterface * r)
+        : latest(1)
+        , backIndex(0)
+        , frontIndex(2)
+        , renderer(r)
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            frames[i].ranges = frames[i].vertexes = frames[i].indexes = SnapshotBuffer();
+        }
+    }
+};
+
+struct InternalContext DD_EXPLICIT_CONTEXT_ONLY(: public OpaqueContextType)
+{
+    int                          vertexBufferUsed;
+    int                          vertexBufferSize;    // Capacity of the vertexBuffer, from the dd::ContextConfig or the RenderInterface.
+    VertexFormat                 vertexFormat;        // Format of the point/line verts, from RenderInterface::getVertexFormat().
+    float                        packedPointSize;     // Size shared by all the points currently in the buffer, if using VertexFormatCompact.
+    std::int64_t                 currentTimeMillis;   // Latest time value (in milliseconds) from dd::flush().
+    int                          renderLayer;         // Layer new draws go to, from dd::setRenderLayer().
+    float                        viewProjMatrix[16];  // Camera from dd::setView(). Only valid if lodPixelScaleSq is not zero.
+    float                        lodPixelScaleSq;     // Squared pixels per world unit at a clip space W of one. Zero without a view.
+    float                        cullPlanes[6][4];    // Normalized planes from dd::setCullingPlanes(), inside on the positive side.
+    bool                         cullingEnabled;      // Set if dd::setCullingPlanes() was given planes.
+    CullStats                    cullStats;           // Shapes culled since the last dd::setCullingPlanes().
+    float                        cullPlaneLanes[4][8]; // The cullPlanes as A, B, C and D lanes for the culling kernels. See cullSegments().
+    bool                         flushCullTimed;      // Set during a dd::flush() with FlushCullTimed, if culling is enabled.
+    GlyphTextureHandle           glyphTexHandle;      // Our built-in glyph bitmap. If kept null, no text is rendered.
+    RenderInterface *            renderInterface;     // Ref to the external renderer. Can be null for a no-op debug draw.
+    DrawVertex *                 vertexBuffer;        // Where the current batch is written, localVertexBuffer or memory from RenderInterface::acquireVertices().
+    CompactVertex *              compactVertexBuffer; // Same memory as vertexBuffer, viewed as packed verts. Used if vertexFormat is compact.
+    DrawVertex *                 localVertexBuffer;   // Vertex buffer we use to expand the lines/points if the renderer doesn't provide one.
+    bool                         vertexBatchAcquired; // Set if vertexBuffer currently points to memory from RenderInterface::acquireVertices().
+    IndexFormat                  indexFormat;         // Format of the line/glyph indexes, from RenderInterface::getIndexFormat().
+    void *                       indexBuffer;         // Indexes of the current batch, if indexFormat is not IndexFormatNone.
+    int                          indexBufferUsed;     // Indexes written to indexBuffer.
+    int                          indexBufferSize;     // Capacity of the indexBuffer, twice the vertexBufferSize.
+
+    // Line vertexes already written to the current indexed batch.
+    VertexCacheEntry             vertexCache[VertexCacheSize];
+
+    // Runs of the current batch waiting to be expanded by the taskScheduler.
+    VertexExpansionJob           expansionJobs[MaxVertexExpansionJobs];
+    char *                       textArena;           // Text of the queued debug strings, all null-terminated. Bump allocated.
+    char *                       textArenaBack;       // Same size as textArena, surviving text is compacted into it after each flush.
+    int                          textArenaUsed;       // Bytes allocated in the textArena.
+    int                          textArenaSize;       // Capacity of each of the two text arena buffers.
+    int                          textArenaReserved;   // Initial textArenaSize from the dd::ContextConfig, which dd::trim() keeps.
+    int                          textArenaHighWater;  // Max value textArenaUsed ever reached.
+    bool                         growableTextArena;   // Set from dd::ContextConfig::growableQueues.
+    Allocator *                  allocator;           // From the dd::ContextConfig. Null to use DD_MALLOC/DD_MFREE.
+    TaskScheduler *              taskScheduler;       // From the dd::ContextConfig. Null to expand the vertexes serially.
+    int                          numExpansionJobs;    // Jobs recorded for the current vertex batch.
+    FlushSlice                   pointSlice;          // Part of the debugPoints drawn by the current dd::flush().
+    FlushSlice                   lineSlice;           // Part of the debugLines drawn by the current dd::flush().
+    std::int64_t                 flushDeadlineMicros; // Time budget of the current dd::flush(), or zero if it has none.
+    bool                         flushOutOfTime;      // Set once the current dd::flush() used up its time budget.
+    SnapshotState *              snapshots;           // Frame snapshots if dd::ContextConfig::frameSnapshots is set, null otherwise.
+    bool                         frameSubmission;     // From RenderInterface::wantsFrameSubmission().
+    bool                         recordingFrame;      // Set while a FrameRecorder stands in for the renderInterface.
+    FrameSnapshot                submissionFrame;     // Where dd::flush() gathers the frame for RenderInterface::submitFrame().
+    bool                         instancedShapes;     // From RenderInterface::wantsInstancedShapes(), unless snapshots or frame submission are used.
+    ShapeInstance *              shapeBatches;        // ShapeBatchSize instances per dd::ShapeId, if instancedShapes is set.
+    int                          shapeBatchCounts[ShapeCount]; // Instances in each of the shapeBatches.
+    DebugQueue<DebugStringArray> debugStrings;        // Debug strings queue (2D screen-space strings + 3D projected labels).
+    DebugQueue<DebugPointArrays> debugPoints;         // 3D debug points queue.
+    DebugQueue<DebugLineArrays>  debugLines;          // 3D debug lines queue.
+    DebugQueue<DebugShapeArrays> debugShapes;         // Shapes queued whole, expanded into lines or drawn instanced by dd::flush().
+
+    // The vertex buffer, queue chunks and text arena are allocated separately. See dd::initialize().
+    InternalContext(RenderInterface * renderer, const ContextConfig & config)
+        : vertexBufferUsed(0)
+        , vertexBufferSize(config.vertexBufferSize)
+        , vertexFormat(renderer->getVertexFormat())
+        , packedPointSize(0.0f)
+        , currentTimeMillis(0)
+        , renderLayer(0)
+        , viewProjMatrix()
+        , lodPixelScaleSq(0.0f)
+        , cullPlanes()
+        , cullingEnabled(false)
+        , cullStats()
+        , cullPlaneLanes()
+        , flushCullTimed(false)
+        , glyphTexHandle(nullptr)
+        , renderInterface(renderer)
+        , vertexBuffer(nullptr)
+        , compactVertexBuffer(nullptr)
+        , localVertexBuffer(nullptr)
+        , vertexBatchAcquired(false)
+        , indexFormat(renderer->getIndexFormat())
+        , indexBuffer(nullptr)
+        , indexBufferUsed(0)
+        , indexBufferSize(0)
+        , textArena(nullptr)
+        , textArenaBack(nullptr)
+        , textArenaUsed(0)
+        , textArenaSize(config.textArenaSize)
+        , textArenaReserved(config.textArenaSize)
+        , textArenaHighWater(0)
+        , growableTextArena(config.growableQueues)
+        , allocator(config.allocator)
+        , taskScheduler(config.taskScheduler)
+        , numExpansionJobs(0)
+        , pointSlice()
+        , lineSlice()
+        , flushDeadlineMicros(0)
+        , flushOutOfTime(false)
+        , snapshots(nullptr)
+        , frameSubmission(renderer->wantsFrameSubmission())
+        , recordingFrame(false)
+        , submissionFrame()
+        , instancedShapes(false)
+        , shapeBatches(nullptr)
+        , shapeBatchCounts()
+        , debugStrings(config.maxStrings, config.growableQueues, config.allocator)
+        , debugPoints(config.maxPoints,   config.growableQueues, config.allocator)
+        , debugLines(config.maxLines,     config.growableQueues, config.allocator)
+        , debugShapes(config.maxShapes,   config.growableQueues, config.allocator)
+    { }
+};
+
+// ========================================================
+// Chunked queue management:
+// ========================================================
+
+template<typename ChunkType>
+static ChunkType * allocQueueChunk(Allocator * allocator)
+{
+    void * memory = allocMemory(allocator, sizeof(ChunkType), alignof(ChunkType), AllocTagQueue);
+    if (memory == nullptr)
+    {
+        return nullptr;
+    }
+    return ::new(memory) ChunkType();
+}
+
+// Frees the chunks of a pool, returning how many were freed.
+template<typename ChunkType>
+static int freeQueueChunkList(Allocator * allocator, ChunkType * chunk)
+{
+    int numFreed = 0;
+    while (chunk != nullptr)
+    {
+        ChunkType * next = chunk->next;
+        chunk->~ChunkType();
+        freeMemory(allocator, chunk, sizeof(ChunkType), AllocTagQueue);
+        chunk = next;
+        ++numFreed;
+    }
+    return numFreed;
+}
+
+// Fills the transient chunk pool with enough chunks for 'numElements'. Timed
+// chunks are only allocated on first use. Returns false if out of memory.
+template<typename ArraysType>
+static bool reserveQueueChunks(DebugQueue<ArraysType> & queue, const int numElements)
+{
+    const int numChunks = (numElements + DEBUG_DRAW_QUEUE_CHUNK_SIZE - 1) / DEBUG_DRAW_QUEUE_CHUNK_SIZE;
+    for (int i = 0; i < numChunks; ++i)
+    {
+        typename DebugQueue<ArraysType>::Chunk * chunk = allocQueueChunk<typename DebugQueue<ArraysType>::Chunk>(queue.allocator);
+        if (chunk == nullptr)
+        {
+            return false;
+        }
+        chunk->next      = queue.freeChunks;
+        queue.freeChunks = chunk;
+        ++queue.numChunks;
+        ++queue.reservedChunks;
+    }
+    return true;
+}
+
+// Appends 'numSlots' consecutive element slots to the end of a chunk list. If 'newChunk'
+// is set, as decided by the caller (see getElementSlots()), the slots start a new chunk,
+// taken from 'pool', or allocated with 'allocator' if the pool is empty, incrementing
+// 'numAllocated'. Returns the chunk holding the slots, or null if out of memory.
+template<typename ChunkType>
+static ChunkType * pushChunkListSlot(DebugChunkList<ChunkType> & list, ChunkType *& pool, Allocator * allocator,
+                                     int & numAllocated, const bool newChunk, const int numSlots, int & outIndex)
+{
+    if (newChunk)
+    {
+        ChunkType * chunk = pool;
+        if (chunk != nullptr)
+        {
+            pool = chunk->next;
+        }
+        else if ((chunk = allocQueueChunk<ChunkType>(allocator)) == nullptr)
+        {
+            return nullptr;
+        }
+        else
+        {
+            ++numAllocated;
+        }
+
+        chunk->next        = nullptr;
+        chunk->count       = 0;
+        chunk->numElements = 0;
+
+        if (list.tail != nullptr)
+        {
+            list.tail->next = chunk;
+        }
+        else
+        {
+            list.head = chunk;
+        }
+        list.tail = chunk;
+    }
+
+    outIndex          = list.tail->count;
+    list.tail->count += numSlots;
+    ++list.tail->numElements;
+    ++list.count;
+    return list.tail;
+}
+
+// Returns every chunk of the list to 'pool' at once, leaving the list empty.
+template<typename ChunkType>
+static void releaseChunkList(DebugChunkList<ChunkType> & list, ChunkType *& pool)
+{
+    if (list.tail != nullptr)
+    {
+        list.tail->next = pool;
+        pool = list.head;
+    }
+    list.head  = nullptr;
+    list.tail  = nullptr;
+    list.count = 0;
+}
+
+// Returns all transient elements to the pool at once.
+template<typename ArraysType>
+static void releaseTransient(DebugQueue<ArraysType> & queue)
+{
+    queue.count -= queue.transientCount;
+    for (int p = 0; p < NumQueuePartitions; ++p)
+    {
+        queue.partitionCounts[p] -= queue.transient[p].count;
+        releaseChunkList(queue.transient[p], queue.freeChunks);
+    }
+    queue.transientCount = 0;
+}
+
+// Unlinks the first bucket of the queue, returning it and all its chunks to the pools.
+template<typename ArraysType>
+static void releaseFirstBucket(DebugQueue<ArraysType> & queue)
+{
+    typename DebugQueue<ArraysType>::Bucket * bucket = queue.buckets;
+    if (queue.lastBucket == bucket)
+    {
+        queue.lastBucket = nullptr;
+    }
+
+    queue.count -= bucket->count;
+    for (int p = 0; p < NumQueuePartitions; ++p)
+    {
+        queue.partitionCounts[p] -= bucket->chunks[p].count;
+        releaseChunkList(bucket->chunks[p], queue.freeTimedChunks);
+    }
+    bucket->count = 0;
+
+    queue.buckets     = bucket->next;
+    bucket->next      = queue.freeBuckets;
+    queue.freeBuckets = bucket;
+}
+
+template<typename ArraysType>
+static void resetQueue(DebugQueue<ArraysType> & queue)
+{
+    releaseTransient(queue);
+    while (queue.buckets != nullptr)
+    {
+        releaseFirstBucket(queue);
+    }
+}
+
+template<typename ArraysType>
+static void destroyQueue(DebugQueue<ArraysType> & queue)
+{
+    // Everything goes back to the pools first, so we only have the pools to free.
+    resetQueue(queue);
+    freeQueueChunkList(queue.allocator, queue.freeChunks);
+    freeQueueChunkList(queue.allocator, queue.freeTimedChunks);
+
+    typename DebugQueue<ArraysType>::Bucket * bucket = queue.freeBuckets;
+    while (bucket != nullptr)
+    {
+        typename DebugQueue<ArraysType>::Bucket * next = bucket->next;
+        freeMemory(queue.allocator, bucket, sizeof(*bucket), AllocTagQueue);
+        bucket = next;
+    }
+
+    queue.freeBuckets     = nullptr;
+    queue.freeChunks      = nullptr;
+    queue.freeTimedChunks = nullptr;
+}
+
+// Frees the pooled chunks and buckets, keeping enough transient
+// chunks in the pool to honor the initial reservation.
+template<typename ArraysType>
+static void trimQueue(DebugQueue<ArraysType> & queue)
+{
+    typedef typename DebugQueue<ArraysType>::Chunk  Chunk;
+    typedef typename DebugQueue<ArraysType>::Bucket Bucket;
+
+    while (queue.freeChunks != nullptr && queue.numChunks > queue.reservedChunks)
+    {
+        Chunk * next = queue.freeChunks->next;
+        queue.freeChunks->~Chunk();
+        freeMemory(queue.allocator, queue.freeChunks, sizeof(Chunk), AllocTagQueue);
+        queue.freeChunks = next;
+        --queue.numChunks;
+    }
+
+    queue.numTimedChunks -= freeQueueChunkList(queue.allocator, queue.freeTimedChunks);
+    queue.freeTimedChunks = nullptr;
+
+    while (queue.freeBuckets != nullptr)
+    {
+        Bucket * next = queue.freeBuckets->next;
+        freeMemory(queue.allocator, queue.freeBuckets, sizeof(Bucket), AllocTagQueue);
+        queue.freeBuckets = next;
+        --queue.numBuckets;
+    }
+}
+
+template<typename ArraysType>
+static void getQueueMemoryStats(const DebugQueue<ArraysType> & queue, QueueMemoryStats & stats)
+{
+    typedef typename DebugQueue<ArraysType>::Chunk      Chunk;
+    typedef typename DebugQueue<ArraysType>::TimedChunk TimedChunk;
+    typedef typename DebugQueue<ArraysType>::Bucket     Bucket;
+
+    int usedChunks = 0;
+    for (int p = 0; p < NumQueuePartitions; ++p)
+    {
+        for (const Chunk * chunk = queue.transient[p].head; chunk != nullptr; chunk = chunk->next)
+        {
+            ++usedChunks;
+        }
+    }
+
+    int usedTimedChunks = 0;
+    int usedBuckets     = 0;
+    for (const Bucket * bucket = queue.buckets; bucket != nullptr; bucket = bucket->next)
+    {
+        for (int p = 0; p < NumQueuePartitions; ++p)
+        {
+            for (const TimedChunk * chunk = bucket->chunks[p].head; chunk != nullptr; chunk = chunk->next)
+            {
+                ++usedTimedChunks;
+            }
+        }
+        ++usedBuckets;
+    }
+
+    stats.reservedBytes  = queue.numChunks      * sizeof(Chunk)
+                         + queue.numTimedChunks * sizeof(TimedChunk)
+                         + queue.numBuckets     * sizeof(Bucket);
+    stats.usedBytes      = usedChunks      * sizeof(Chunk)
+                         + usedTimedChunks * sizeof(TimedChunk)
+                         + usedBuckets     * sizeof(Bucket);
+    stats.count          = queue.count;
+    stats.highWaterCount = queue.highWaterCount;
+}
+
+//
+// Per element type copy used to move timed elements to finer expiry buckets:
+//
+
+static inline void moveElement(DebugStringArray & dst, const int dstIndex, const DebugStringArray & src, const int srcIndex)
+{
+    dst.strings[dstIndex] = src.strings[srcIndex];
+}
+
+static inline void moveElement(DebugPointArrays & dst, const int dstIndex, const DebugPointArrays & src, const int srcIndex)
+{
+    for (int c = 0; c < 3; ++c)
+    {
+        dst.positions[dstIndex][c] = src.positions[srcIndex][c];
+    }
+    #ifdef DEBUG_DRAW_QUANTIZED_POSITIONS
+    dst.slotKinds[dstIndex] = src.slotKinds[srcIndex];
+    #endif // DEBUG_DRAW_QUANTIZED_POSITIONS
+    dst.colors[dstIndex] = src.colors[srcIndex];
+    dst.sizes[dstIndex]  = src.sizes[srcIndex];
+}
+
+static inline void moveElement(DebugLineArrays & dst, const int dstIndex, const DebugLineArrays & src, const int srcIndex)
+{
+    for (int c = 0; c < 6; ++c)
+    {
+        dst.positions[dstIndex][c] = src.positions[srcIndex][c];
+    }
+    #ifdef DEBUG_DRAW_QUANTIZED_POSITIONS
+    dst.slotKinds[dstIndex] = src.slotKinds[srcIndex];
+    #endif // DEBUG_DRAW_QUANTIZED_POSITIONS
+    dst.colors[dstIndex] = src.colors[srcIndex];
+}
+
+static inline void moveElement(DebugShapeArrays & dst, const int dstIndex, const DebugShapeArrays & src, const int srcIndex)
+{
+    dst.instances[dstIndex] = src.instances[srcIndex];
+    dst.shapeIds[dstIndex]  = src.shapeIds[srcIndex];
+}
+
+// ========================================================
+// Library context mode selection:
+// ========================================================
+
+#if (defined(DEBUG_DRAW_PER_THREAD_CONTEXT) && defined(DEBUG_DRAW_EXPLICIT_CONTEXT))
+    #error "DEBUG_DRAW_PER_THREAD_CONTEXT and DEBUG_DRAW_EXPLICIT_CONTEXT are mutually exclusive!"
+#endif // DEBUG_DRAW_PER_THREAD_CONTEXT && DEBUG_DRAW_EXPLICIT_CONTEXT
+
+#if defined(DEBUG_DRAW_EXPLICIT_CONTEXT)
+    //
+    // Explicit context passed as argument
+    //
+    #define DD_CONTEXT static_cast<InternalContext *>(ctx)
+#elif defined(DEBUG_DRAW_PER_THREAD_CONTEXT)
+    //
+    // Per-thread global context (MT safe)
+    //
+    #if defined(__GNUC__) || defined(__clang__) // GCC/Clang
+        #define DD_THREAD_LOCAL static __thread
+    #elif defined(_MSC_VER) // Visual Studio
+        #define DD_THREAD_LOCAL static __declspec(thread)
+    #else // Try C++11 thread_local
+        #if DEBUG_DRAW_CXX11_SUPPORTED
+            #define DD_THREAD_LOCAL static thread_local
+        #else // !DEBUG_DRAW_CXX11_SUPPORTED
+            #error "Unsupported compiler - unknown TLS model"
+        #endif // DEBUG_DRAW_CXX11_SUPPORTED
+    #endif // TLS model
+    DD_THREAD_LOCAL InternalContext * s_threadContext = nullptr;
+    #define DD_CONTEXT s_threadContext
+    #undef DD_THREAD_LOCAL
+#else // Debug Draw context selection
+    //
+    // Global static context (single threaded operation)
+    //
+    static InternalContext * s_globalContext = nullptr;
+    #define DD_CONTEXT s_globalContext
+#endif // Debug Draw context selection
+
+// ========================================================
+
+#if DEBUG_DRAW_USE_STD_MATH
+
+static inline float floatAbs(float x)       { return fabsf(x); }
+static inline float floatSin(float radians) { return sinf(radians); }
+static inline float floatCos(float radians) { return cosf(radians); }
+static inline float floatInvSqrt(float x)   { return (1.0f / sqrtf(x)); }
 
 #else // !DEBUG_DRAW_USE_STD_MATH
 
@@ -2040,6 +3296,52 @@ static inline float floatCos(float radians)
 
 #endif // DEBUG_DRAW_USE_STD_MATH
 
+// ========================================================
+// Unit circle tables for the fixed-step shapes:
+// ========================================================
+
+struct SinCos
+{
+    float s;
+    float c;
+};
+
+// Sine and cosine of every multiple of the step from 0 to 360 degrees (inclusive),
+// so the fixed-step shapes can index by (degrees / stepSize) instead of calling
+// floatSin/floatCos in their inner loops. Filled with literals, so these are
+// constant-initialized and the same under both DEBUG_DRAW_USE_STD_MATH settings.
+static const SinCos unitCircle15Deg[25] = {
+    {  0.000000000f,  1.000000000f }, {  0.258819045f,  0.965925826f }, {  0.500000000f,  0.866025404f },
+    {  0.707106781f,  0.707106781f }, {  0.866025404f,  0.500000000f }, {  0.965925826f,  0.258819045f },
+    {  1.000000000f,  0.000000000f }, {  0.965925826f, -0.258819045f }, {  0.866025404f, -0.500000000f },
+    {  0.707106781f, -0.707106781f }, {  0.500000000f, -0.866025404f }, {  0.258819045f, -0.965925826f },
+    {  0.000000000f, -1.000000000f }, { -0.258819045f, -0.965925826f }, { -0.500000000f, -0.866025404f },
+    { -0.707106781f, -0.707106781f }, { -0.866025404f, -0.500000000f }, { -0.965925826f, -0.258819045f },
+    { -1.000000000f,  0.000000000f }, { -0.965925826f,  0.258819045f }, { -0.866025404f,  0.500000000f },
+    { -0.707106781f,  0.707106781f }, { -0.500000000f,  0.866025404f }, { -0.258819045f,  0.965925826f },
+    {  0.000000000f,  1.000000000f }
+};
+static const SinCos unitCircle20Deg[19] = {
+    {  0.000000000f,  1.000000000f }, {  0.342020143f,  0.939692621f }, {  0.642787610f,  0.766044443f },
+    {  0.866025404f,  0.500000000f }, {  0.984807753f,  0.173648178f }, {  0.984807753f, -0.173648178f },
+    {  0.866025404f, -0.500000000f }, {  0.642787610f, -0.766044443f }, {  0.342020143f, -0.939692621f },
+    {  0.000000000f, -1.000000000f }, { -0.342020143f, -0.939692621f }, { -0.642787610f, -0.766044443f },
+    { -0.866025404f, -0.500000000f }, { -0.984807753f, -0.173648178f }, { -0.984807753f,  0.173648178f },
+    { -0.866025404f,  0.500000000f }, { -0.642787610f,  0.766044443f }, { -0.342020143f,  0.939692621f },
+    {  0.000000000f,  1.000000000f }
+};
+
+// Advances (s, c) by the angle whose sine and cosine are (stepS, stepC).
+// Used by the shapes with an arbitrary step count, which then only need
+// a single floatSin/floatCos pair for the step angle.
+static inline void rotateSinCos(float & s, float & c, const float stepS, const float stepC)
+{
+    const float rs = s * stepC + c * stepS;
+    const float rc = c * stepC - s * stepS;
+    s = rs;
+    c = rc;
+}
+
 // ========================================================
 // ddVec3 helpers:
 // ========================================================
@@ -2126,528 +3428,3710 @@ static inline void vecOrthogonalBasis(ddVec3_Out left, ddVec3_Out up, ddVec3_In
 }
 
 // ========================================================
-// ddMat4x4 helpers:
+// Packed RGBA8 color helpers:
 // ========================================================
 
-static inline void matTransformPointXYZ(ddVec3_Out result, ddVec3_In p, ddMat4x4_In m)
+static inline std::uint32_t packColorChannel(const float c)
 {
-    result[X] = (m[0] * p[X]) + (m[4] * p[Y]) + (m[8]  * p[Z]) + m[12]; // p[W] assumed to be 1
-    result[Y] = (m[1] * p[X]) + (m[5] * p[Y]) + (m[9]  * p[Z]) + m[13];
-    result[Z] = (m[2] * p[X]) + (m[6] * p[Y]) + (m[10] * p[Z]) + m[14];
+    // Clamped to [0,1] and rounded to the nearest 8-bits value.
+    if (c <= 0.0f) { return 0;   }
+    if (c >= 1.0f) { return 255; }
+    return static_cast<std::uint32_t>(c * 255.0f + 0.5f);
 }
 
-static inline void matTransformPointXYZW(float result[4], ddVec3_In p, ddMat4x4_In m)
+static inline std::uint32_t packColor(ddVec3_In color)
 {
-    result[X] = (m[0] * p[X]) + (m[4] * p[Y]) + (m[8]  * p[Z]) + m[12]; // p[W] assumed to be 1
-    result[Y] = (m[1] * p[X]) + (m[5] * p[Y]) + (m[9]  * p[Z]) + m[13];
-    result[Z] = (m[2] * p[X]) + (m[6] * p[Y]) + (m[10] * p[Z]) + m[14];
-    result[W] = (m[3] * p[X]) + (m[7] * p[Y]) + (m[11] * p[Z]) + m[15];
+    return packColorChannel(color[X])         |
+          (packColorChannel(color[Y]) << 8)   |
+          (packColorChannel(color[Z]) << 16)  |
+          (static_cast<std::uint32_t>(255) << 24);
 }
 
-static inline float matTransformPointXYZW2(ddVec3_Out result, const float p[3], ddMat4x4_In m)
+static inline float unpackColorChannel(const std::uint32_t color, const int shift)
 {
-    result[X] = (m[0] * p[X]) + (m[4] * p[Y]) + (m[8]  * p[Z]) + m[12]; // p[W] assumed to be 1
-    result[Y] = (m[1] * p[X]) + (m[5] * p[Y]) + (m[9]  * p[Z]) + m[13];
-    result[Z] = (m[2] * p[X]) + (m[6] * p[Y]) + (m[10] * p[Z]) + m[14];
-    float rw  = (m[3] * p[X]) + (m[7] * p[Y]) + (m[11] * p[Z]) + m[15];
-    return rw;
+    return static_cast<float>((color >> shift) & 0xFF) * (1.0f / 255.0f);
 }
 
 // ========================================================
-// Misc local functions for draw queue management:
+// Vertex expansion kernels:
 // ========================================================
 
-enum DrawMode
-{
-    DrawModePoints,
-    DrawModeLines,
-    DrawModeText
-};
+#ifndef DEBUG_DRAW_QUANTIZED_POSITIONS
+
+//
+// These expand a run of 'count' queued points or lines into dd::DrawVertex memory,
+// 7 floats per vertex. Callers make sure there is room for all of them beforehand,
+// so the loops don't have to check the buffer. Line vertexes don't use the last float
+// (point size), which the SIMD kernels set to zero. Results are otherwise identical
+// to the scalar code, colors are unpacked with the same multiply by 1/255.
+//
 
-static void flushDebugVerts(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const DrawMode mode, const bool depthEnabled)
+#if DD_SIMD_AVX2
+
+static void expandPointVerts(const float (*positions)[3], const std::uint32_t * colors,
+                             const float * sizes, const int count, DrawVertex * out)
 {
-    if (DD_CONTEXT->vertexBufferUsed == 0)
+    const __m256i mask3   = _mm256_setr_epi32(-1, -1, -1, 0, 0, 0, 0, 0);
+    const __m256i mask7   = _mm256_setr_epi32(-1, -1, -1, -1, -1, -1, -1, 0);
+    const __m256i permRGB = _mm256_setr_epi32(0, 0, 0, 0, 1, 2, 0, 0);
+    const __m128  scale   = _mm_set1_ps(1.0f / 255.0f);
+
+    float * dest = reinterpret_cast<float *>(out);
+    for (int i = 0; i < count; ++i, dest += 7)
     {
-        return;
+        const __m128 rgba = _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(static_cast<int>(colors[i])))), scale);
+        const __m256 xyz  = _mm256_maskload_ps(positions[i], mask3);                               // x y z 0 0 0 0 0
+        const __m256 rgb  = _mm256_permutevar8x32_ps(_mm256_castps128_ps256(rgba), permRGB);      // - - - r g b - -
+        const __m256 size = _mm256_broadcast_ss(&sizes[i]);
+        _mm256_maskstore_ps(dest, mask7, _mm256_blend_ps(_mm256_blend_ps(xyz, rgb, 0x38), size, 0x40));
     }
+}
 
-    switch (mode)
+static void expandLineVerts(const float (*positions)[6], const std::uint32_t * colors,
+                            const int count, DrawVertex * out)
+{
+    const __m256i mask6    = _mm256_setr_epi32(-1, -1, -1, -1, -1, -1, 0, 0);
+    const __m256i permFrom = _mm256_setr_epi32(0, 1, 2, 6, 6, 6, 6, 3); // x0 y0 z0 0 0 0 0 x1
+    const __m256i permTo   = _mm256_setr_epi32(4, 5, 6, 6, 6, 6, 6, 6); // y1 z1 0 0 0 0 0 0
+    const __m256i permRGB0 = _mm256_setr_epi32(0, 0, 0, 0, 1, 2, 0, 0); // - - - r g b - -
+    const __m256i permRGB1 = _mm256_setr_epi32(0, 0, 0, 1, 2, 0, 0, 0); // - - r g b - - -
+    const __m128  scale    = _mm_set1_ps(1.0f / 255.0f);
+
+    float * dest = reinterpret_cast<float *>(out);
+    for (int i = 0; i < count; ++i, dest += 14)
     {
-    case DrawModePoints :
-        DD_CONTEXT->renderInterface->drawPointList(DD_CONTEXT->vertexBuffer,
-                                                   DD_CONTEXT->vertexBufferUsed,
-                                                   depthEnabled);
-        break;
-    case DrawModeLines :
-        DD_CONTEXT->renderInterface->drawLineList(DD_CONTEXT->vertexBuffer,
-                                                  DD_CONTEXT->vertexBufferUsed,
-                                                  depthEnabled);
-        break;
-    case DrawModeText :
-        DD_CONTEXT->renderInterface->drawGlyphList(DD_CONTEXT->vertexBuffer,
-                                                   DD_CONTEXT->vertexBufferUsed,
-                                                   DD_CONTEXT->glyphTexHandle);
-        break;
-    } // switch (mode)
+        const __m128 rgba = _mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(static_cast<int>(colors[i])))), scale);
+        const __m256 rgb  = _mm256_castps128_ps256(rgba);
+        const __m256 line = _mm256_maskload_ps(positions[i], mask6); // x0 y0 z0 x1 y1 z1 0 0
+
+        // First vertex plus X of the second, then the rest of the second vertex:
+        const __m256 v0 = _mm256_blend_ps(_mm256_permutevar8x32_ps(line, permFrom), _mm256_permutevar8x32_ps(rgb, permRGB0), 0x38);
+        const __m256 v1 = _mm256_blend_ps(_mm256_permutevar8x32_ps(line, permTo),   _mm256_permutevar8x32_ps(rgb, permRGB1), 0x1C);
+        _mm256_storeu_ps(dest, v0);
+        _mm256_maskstore_ps(dest + 8, mask6, v1);
+    }
+}
 
-    DD_CONTEXT->vertexBufferUsed = 0;
+#elif DD_SIMD_SSE2
+
+static inline __m128 unpackColorSSE2(const std::uint32_t color, const __m128 scale)
+{
+    const __m128i zero  = _mm_setzero_si128();
+    const __m128i bytes = _mm_cvtsi32_si128(static_cast<int>(color));
+    const __m128i rgba  = _mm_unpacklo_epi16(_mm_unpacklo_epi8(bytes, zero), zero);
+    return _mm_mul_ps(_mm_cvtepi32_ps(rgba), scale);
 }
 
-static void pushPointVert(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const DebugPoint & point)
+static void expandPointVerts(const float (*positions)[3], const std::uint32_t * colors,
+                             const float * sizes, const int count, DrawVertex * out)
 {
-    // Make room for one more vert:
-    if ((DD_CONTEXT->vertexBufferUsed + 1) >= DEBUG_DRAW_VERTEX_BUFFER_SIZE)
+    const __m128 scale = _mm_set1_ps(1.0f / 255.0f);
+
+    float * dest = reinterpret_cast<float *>(out);
+    for (int i = 0; i < count; ++i, dest += 7)
     {
-        flushDebugVerts(DD_EXPLICIT_CONTEXT_ONLY(ctx,) DrawModePoints, point.depthEnabled);
+        const __m128 rgba = unpackColorSSE2(colors[i], scale);
+        const __m128 xy   = _mm_loadl_pi(_mm_setzero_ps(), reinterpret_cast<const __m64 *>(positions[i]));
+        const __m128 xyz  = _mm_movelh_ps(xy, _mm_load_ss(&positions[i][2]));         // x y z 0
+        const __m128 zr   = _mm_shuffle_ps(xyz, rgba, _MM_SHUFFLE(0, 0, 2, 2));        // z z r r
+        _mm_storeu_ps(dest, _mm_shuffle_ps(xyz, zr, _MM_SHUFFLE(2, 0, 1, 0)));         // x y z r
+        _mm_storel_pi(reinterpret_cast<__m64 *>(dest + 4), _mm_shuffle_ps(rgba, rgba, _MM_SHUFFLE(0, 0, 2, 1))); // g b
+        _mm_store_ss(dest + 6, _mm_load_ss(&sizes[i]));
     }
-
-    DrawVertex & v = DD_CONTEXT->vertexBuffer[DD_CONTEXT->vertexBufferUsed++];
-    v.point.x      = point.position[X];
-    v.point.y      = point.position[Y];
-    v.point.z      = point.position[Z];
-    v.point.r      = point.color[X];
-    v.point.g      = point.color[Y];
-    v.point.b      = point.color[Z];
-    v.point.size   = point.size;
 }
 
-static void pushLineVert(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const DebugLine & line)
+static void expandLineVerts(const float (*positions)[6], const std::uint32_t * colors,
+                            const int count, DrawVertex * out)
 {
-    // Make room for two more verts:
-    if ((DD_CONTEXT->vertexBufferUsed + 2) >= DEBUG_DRAW_VERTEX_BUFFER_SIZE)
+    const __m128 scale = _mm_set1_ps(1.0f / 255.0f);
+    const __m128 zero  = _mm_setzero_ps();
+
+    float * dest = reinterpret_cast<float *>(out);
+    for (int i = 0; i < count; ++i, dest += 14)
     {
-        flushDebugVerts(DD_EXPLICIT_CONTEXT_ONLY(ctx,) DrawModeLines, line.depthEnabled);
+        const __m128 rgba = unpackColorSSE2(colors[i], scale);
+        const __m128 from = _mm_loadu_ps(positions[i]);                                                // x0 y0 z0 x1
+        const __m128 to   = _mm_loadl_pi(zero, reinterpret_cast<const __m64 *>(&positions[i][4]));    // y1 z1 0 0
+        const __m128 zr   = _mm_shuffle_ps(from, rgba, _MM_SHUFFLE(0, 0, 2, 2));                      // z0 z0 r r
+        const __m128 x1   = _mm_shuffle_ps(from, zero, _MM_SHUFFLE(0, 0, 3, 3));                      // x1 x1 0 0
+        _mm_storeu_ps(dest,     _mm_shuffle_ps(from, zr,   _MM_SHUFFLE(2, 0, 1, 0)));                 // x0 y0 z0 r
+        _mm_storeu_ps(dest + 4, _mm_shuffle_ps(rgba, x1,   _MM_SHUFFLE(0, 2, 2, 1)));                 // g b 0 x1
+        _mm_storeu_ps(dest + 8, _mm_shuffle_ps(to,   rgba, _MM_SHUFFLE(1, 0, 1, 0)));                 // y1 z1 r g
+        _mm_storel_pi(reinterpret_cast<__m64 *>(dest + 12), _mm_unpackhi_ps(rgba, zero));             // b 0
     }
+}
 
-    DrawVertex & v0 = DD_CONTEXT->vertexBuffer[DD_CONTEXT->vertexBufferUsed++];
-    DrawVertex & v1 = DD_CONTEXT->vertexBuffer[DD_CONTEXT->vertexBufferUsed++];
+#elif DD_SIMD_NEON
 
-    v0.line.x = line.posFrom[X];
-    v0.line.y = line.posFrom[Y];
-    v0.line.z = line.posFrom[Z];
-    v0.line.r = line.color[X];
-    v0.line.g = line.color[Y];
-    v0.line.b = line.color[Z];
+static inline float32x4_t unpackColorNEON(const std::uint32_t color)
+{
+    const uint8x8_t   bytes = vcreate_u8(color);
+    const uint32x4_t  rgba  = vmovl_u16(vget_low_u16(vmovl_u8(bytes)));
+    return vmulq_n_f32(vcvtq_f32_u32(rgba), 1.0f / 255.0f);
+}
 
-    v1.line.x = line.posTo[X];
-    v1.line.y = line.posTo[Y];
-    v1.line.z = line.posTo[Z];
-    v1.line.r = line.color[X];
-    v1.line.g = line.color[Y];
-    v1.line.b = line.color[Z];
+static void expandPointVerts(const float (*positions)[3], const std::uint32_t * colors,
+                             const float * sizes, const int count, DrawVertex * out)
+{
+    float * dest = reinterpret_cast<float *>(out);
+    for (int i = 0; i < count; ++i, dest += 7)
+    {
+        const float32x4_t rgba = unpackColorNEON(colors[i]);
+        const float32x2_t zr   = vset_lane_f32(vgetq_lane_f32(rgba, 0), vdup_n_f32(positions[i][2]), 1);
+        vst1q_f32(dest, vcombine_f32(vld1_f32(positions[i]), zr));               // x y z r
+        vst1_f32(dest + 4, vget_low_f32(vextq_f32(rgba, rgba, 1)));              // g b
+        dest[6] = sizes[i];
+    }
 }
 
-static void pushGlyphVerts(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const DrawVertex verts[4])
+static void expandLineVerts(const float (*positions)[6], const std::uint32_t * colors,
+                            const int count, DrawVertex * out)
 {
-    static const int indexes[6] = { 0, 1, 2, 2, 1, 3 };
+    const float32x2_t zero = vdup_n_f32(0.0f);
 
-    // Make room for one more glyph (2 tris):
-    if ((DD_CONTEXT->vertexBufferUsed + 6) >= DEBUG_DRAW_VERTEX_BUFFER_SIZE)
+    float * dest = reinterpret_cast<float *>(out);
+    for (int i = 0; i < count; ++i, dest += 14)
     {
-        flushDebugVerts(DD_EXPLICIT_CONTEXT_ONLY(ctx,) DrawModeText, false);
+        const float32x4_t rgba = unpackColorNEON(colors[i]);
+        const float32x4_t from = vld1q_f32(positions[i]);                                   // x0 y0 z0 x1
+        const float32x2_t x1   = vset_lane_f32(vgetq_lane_f32(from, 3), zero, 1);           // 0 x1
+        vst1q_f32(dest,     vsetq_lane_f32(vgetq_lane_f32(rgba, 0), from, 3));              // x0 y0 z0 r
+        vst1q_f32(dest + 4, vcombine_f32(vget_low_f32(vextq_f32(rgba, rgba, 1)), x1));      // g b 0 x1
+        vst1q_f32(dest + 8, vcombine_f32(vld1_f32(&positions[i][4]), vget_low_f32(rgba)));  // y1 z1 r g
+        vst1_f32(dest + 12, vset_lane_f32(vgetq_lane_f32(rgba, 2), zero, 0));               // b 0
     }
+}
 
-    for (int i = 0; i < 6; ++i)
+#else // Scalar fallback
+
+static void expandPointVerts(const float (*positions)[3], const std::uint32_t * colors,
+                             const float * sizes, const int count, DrawVertex * out)
+{
+    for (int i = 0; i < count; ++i)
     {
-        DD_CONTEXT->vertexBuffer[DD_CONTEXT->vertexBufferUsed++].glyph = verts[indexes[i]].glyph;
+        DrawVertex & v = out[i];
+        v.point.x    = positions[i][X];
+        v.point.y    = positions[i][Y];
+        v.point.z    = positions[i][Z];
+        v.point.r    = unpackColorChannel(colors[i], 0);
+        v.point.g    = unpackColorChannel(colors[i], 8);
+        v.point.b    = unpackColorChannel(colors[i], 16);
+        v.point.size = sizes[i];
     }
 }
 
-static void pushStringGlyphs(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) float x, float y,
-                             const char * text, ddVec3_In color, const float scaling)
+static void expandLineVerts(const float (*positions)[6], const std::uint32_t * colors,
+                            const int count, DrawVertex * out)
 {
-    // Invariants for all characters:
-    const float initialX    = x;
-    const float scaleU      = static_cast<float>(getFontCharSet().bitmapWidth);
-    const float scaleV      = static_cast<float>(getFontCharSet().bitmapHeight);
-    const float fixedWidth  = static_cast<float>(getFontCharSet().charWidth);
-    const float fixedHeight = static_cast<float>(getFontCharSet().charHeight);
-    const float tabW        = fixedWidth  * 4.0f * scaling; // TAB = 4 spaces.
-    const float chrW        = fixedWidth  * scaling;
-    const float chrH        = fixedHeight * scaling;
-
-    for (; *text != '\0'; ++text)
+    for (int i = 0; i < count; ++i, out += 2)
     {
-        const int charVal = *text;
-        if (charVal >= FontCharSet::MaxChars)
-        {
-            continue;
-        }
-        if (charVal == ' ')
-        {
-            x += chrW;
-            continue;
-        }
-        if (charVal == '\t')
-        {
-            x += tabW;
-            continue;
-        }
-        if (charVal == '\n')
-        {
-            y += chrH;
-            x  = initialX;
-            continue;
-        }
+        const float r = unpackColorChannel(colors[i], 0);
+        const float g = unpackColorChannel(colors[i], 8);
+        const float b = unpackColorChannel(colors[i], 16);
+
+        out[0].line.x = positions[i][0];
+        out[0].line.y = positions[i][1];
+        out[0].line.z = positions[i][2];
+        out[0].line.r = r;
+        out[0].line.g = g;
+        out[0].line.b = b;
+
+        out[1].line.x = positions[i][3];
+        out[1].line.y = positions[i][4];
+        out[1].line.z = positions[i][5];
+        out[1].line.r = r;
+        out[1].line.g = g;
+        out[1].line.b = b;
+    }
+}
 
-        const FontChar fontChar = getFontCharSet().chars[charVal];
-        const float u0 = (fontChar.x + 0.5f) / scaleU;
-        const float v0 = (fontChar.y + 0.5f) / scaleV;
-        const float u1 = u0 + (fixedWidth  / scaleU);
-        const float v1 = v0 + (fixedHeight / scaleV);
+#endif // DD_SIMD_*
 
-        DrawVertex verts[4];
-        verts[0].glyph.x = x;
-        verts[0].glyph.y = y;
-        verts[0].glyph.u = u0;
-        verts[0].glyph.v = v0;
-        verts[0].glyph.r = color[X];
-        verts[0].glyph.g = color[Y];
-        verts[0].glyph.b = color[Z];
-        verts[1].glyph.x = x;
-        verts[1].glyph.y = y + chrH;
-        verts[1].glyph.u = u0;
-        verts[1].glyph.v = v1;
-        verts[1].glyph.r = color[X];
-        verts[1].glyph.g = color[Y];
-        verts[1].glyph.b = color[Z];
-        verts[2].glyph.x = x + chrW;
-        verts[2].glyph.y = y;
-        verts[2].glyph.u = u1;
-        verts[2].glyph.v = v0;
-        verts[2].glyph.r = color[X];
-        verts[2].glyph.g = color[Y];
-        verts[2].glyph.b = color[Z];
-        verts[3].glyph.x = x + chrW;
-        verts[3].glyph.y = y + chrH;
-        verts[3].glyph.u = u1;
-        verts[3].glyph.v = v1;
-        verts[3].glyph.r = color[X];
-        verts[3].glyph.g = color[Y];
-        verts[3].glyph.b = color[Z];
+#endif // DEBUG_DRAW_QUANTIZED_POSITIONS
 
-        pushGlyphVerts(DD_EXPLICIT_CONTEXT_ONLY(ctx,) verts);
-        x += chrW;
-    }
-}
+// ========================================================
+// Culling kernels:
+// ========================================================
 
-static float calcTextWidth(const char * text, const float scaling)
+//
+// These test 'count' segments against the culling planes, setting 'culled[i]' if
+// segment 'i' is entirely behind any of them. Segment 'i' goes from positions[i * stride]
+// to positions[i * stride + toOffset], so points are tested as segments of zero length.
+// The planes come as A, B, C and D lanes, padded to 8 with planes that have everything
+// inside, so the SIMD kernels test all the planes of a segment at once.
+//
+
+static const int NumCullPlanes = 6;
+
+#if DD_SIMD_AVX2
+
+static void cullSegments(const float (&lanes)[4][8], const float * positions, const int stride,
+                         const int toOffset, const int count, std::uint8_t * culled)
 {
-    const float fixedWidth = static_cast<float>(getFontCharSet().charWidth);
-    const float tabW = fixedWidth * 4.0f * scaling; // TAB = 4 spaces.
-    const float chrW = fixedWidth * scaling;
+    const __m256 a = _mm256_loadu_ps(lanes[0]);
+    const __m256 b = _mm256_loadu_ps(lanes[1]);
+    const __m256 c = _mm256_loadu_ps(lanes[2]);
+    const __m256 d = _mm256_loadu_ps(lanes[3]);
+    const __m256 zero = _mm256_setzero_ps();
 
-    float x = 0.0f;
-    for (; *text != '\0'; ++text)
+    for (int i = 0; i < count; ++i, positions += stride)
     {
-        // Tabs are handled differently (4 spaces)
-        if (*text == '\t')
-        {
-            x += tabW;
-        }
-        else // Non-tab char (including whitespace)
-        {
-            x += chrW;
-        }
+        const float * from = positions;
+        const float * to   = positions + toOffset;
+        const __m256 distFrom = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a, _mm256_set1_ps(from[X])), _mm256_mul_ps(b, _mm256_set1_ps(from[Y]))),
+                                              _mm256_add_ps(_mm256_mul_ps(c, _mm256_set1_ps(from[Z])), d));
+        const __m256 distTo   = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a, _mm256_set1_ps(to[X])), _mm256_mul_ps(b, _mm256_set1_ps(to[Y]))),
+                                              _mm256_add_ps(_mm256_mul_ps(c, _mm256_set1_ps(to[Z])), d));
+        const __m256 behind   = _mm256_and_ps(_mm256_cmp_ps(distFrom, zero, _CMP_LT_OQ), _mm256_cmp_ps(distTo, zero, _CMP_LT_OQ));
+        culled[i] = (_mm256_movemask_ps(behind) != 0);
     }
-
-    return x;
 }
 
-static void drawDebugStrings(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx))
+#elif DD_SIMD_SSE2
+
+static inline __m128 planeDistancesSSE2(const __m128 planes[4], const float * point)
 {
-    const int count = DD_CONTEXT->debugStringsCount;
-    if (count == 0)
-    {
-        return;
-    }
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(planes[0], _mm_set1_ps(point[X])), _mm_mul_ps(planes[1], _mm_set1_ps(point[Y]))),
+                      _mm_add_ps(_mm_mul_ps(planes[2], _mm_set1_ps(point[Z])), planes[3]));
+}
 
-    const DebugString * const debugStrings = DD_CONTEXT->debugStrings;
+static void cullSegments(const float (&lanes)[4][8], const float * positions, const int stride,
+                         const int toOffset, const int count, std::uint8_t * culled)
+{
+    const __m128 lo[4] = { _mm_loadu_ps(lanes[0]),     _mm_loadu_ps(lanes[1]),     _mm_loadu_ps(lanes[2]),     _mm_loadu_ps(lanes[3])     };
+    const __m128 hi[4] = { _mm_loadu_ps(lanes[0] + 4), _mm_loadu_ps(lanes[1] + 4), _mm_loadu_ps(lanes[2] + 4), _mm_loadu_ps(lanes[3] + 4) };
+    const __m128 zero  = _mm_setzero_ps();
 
-    for (int i = 0; i < count; ++i)
+    for (int i = 0; i < count; ++i, positions += stride)
     {
-        const DebugString & dstr = debugStrings[i];
-        if (dstr.centered)
-        {
-            // 3D Labels are centered at the point of origin, e.g. center-aligned.
-            const float offset = calcTextWidth(dstr.text.c_str(), dstr.scaling) * 0.5f;
-            pushStringGlyphs(DD_EXPLICIT_CONTEXT_ONLY(ctx,) dstr.posX - offset, dstr.posY, dstr.text.c_str(), dstr.color, dstr.scaling);
-        }
-        else
-        {
-            // Left-aligned
-            pushStringGlyphs(DD_EXPLICIT_CONTEXT_ONLY(ctx,) dstr.posX, dstr.posY, dstr.text.c_str(), dstr.color, dstr.scaling);
-        }
+        const float * from = positions;
+        const float * to   = positions + toOffset;
+        const __m128 behindLo = _mm_and_ps(_mm_cmplt_ps(planeDistancesSSE2(lo, from), zero), _mm_cmplt_ps(planeDistancesSSE2(lo, to), zero));
+        const __m128 behindHi = _mm_and_ps(_mm_cmplt_ps(planeDistancesSSE2(hi, from), zero), _mm_cmplt_ps(planeDistancesSSE2(hi, to), zero));
+        culled[i] = (_mm_movemask_ps(_mm_or_ps(behindLo, behindHi)) != 0);
     }
+}
 
-    flushDebugVerts(DD_EXPLICIT_CONTEXT_ONLY(ctx,) DrawModeText, false);
+#elif DD_SIMD_NEON
+
+static inline uint32x4_t behindPlanesNEON(const float32x4_t planes[4], const float * from, const float * to)
+{
+    const float32x4_t zero     = vdupq_n_f32(0.0f);
+    const float32x4_t distFrom = vmlaq_n_f32(vmlaq_n_f32(vmlaq_n_f32(planes[3], planes[0], from[X]), planes[1], from[Y]), planes[2], from[Z]);
+    const float32x4_t distTo   = vmlaq_n_f32(vmlaq_n_f32(vmlaq_n_f32(planes[3], planes[0], to[X]),   planes[1], to[Y]),   planes[2], to[Z]);
+    return vandq_u32(vcltq_f32(distFrom, zero), vcltq_f32(distTo, zero));
 }
 
-static void drawDebugPoints(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx))
+static void cullSegments(const float (&lanes)[4][8], const float * positions, const int stride,
+                         const int toOffset, const int count, std::uint8_t * culled)
 {
-    const int count = DD_CONTEXT->debugPointsCount;
-    if (count == 0)
+    const float32x4_t lo[4] = { vld1q_f32(lanes[0]),     vld1q_f32(lanes[1]),     vld1q_f32(lanes[2]),     vld1q_f32(lanes[3])     };
+    const float32x4_t hi[4] = { vld1q_f32(lanes[0] + 4), vld1q_f32(lanes[1] + 4), vld1q_f32(lanes[2] + 4), vld1q_f32(lanes[3] + 4) };
+
+    for (int i = 0; i < count; ++i, positions += stride)
     {
-        return;
+        const float * from = positions;
+        const float * to   = positions + toOffset;
+        culled[i] = (vmaxvq_u32(vorrq_u32(behindPlanesNEON(lo, from, to), behindPlanesNEON(hi, from, to))) != 0);
     }
+}
 
-    const DebugPoint * const debugPoints = DD_CONTEXT->debugPoints;
+#else // Scalar fallback
 
-    //
-    // First pass, points with depth test ENABLED:
-    //
-    int numDepthlessPoints = 0;
-    for (int i = 0; i < count; ++i)
+static void cullSegments(const float (&lanes)[4][8], const float * positions, const int stride,
+                         const int toOffset, const int count, std::uint8_t * culled)
+{
+    for (int i = 0; i < count; ++i, positions += stride)
     {
-        const DebugPoint & point = debugPoints[i];
-        if (point.depthEnabled)
-        {
-            pushPointVert(DD_EXPLICIT_CONTEXT_ONLY(ctx,) point);
-        }
-        numDepthlessPoints += !point.depthEnabled;
-    }
-    flushDebugVerts(DD_EXPLICIT_CONTEXT_ONLY(ctx,) DrawModePoints, true);
+        const float * from = positions;
+        const float * to   = positions + toOffset;
 
-    //
-    // Second pass draws points with depth DISABLED:
-    //
-    if (numDepthlessPoints > 0)
-    {
-        for (int i = 0; i < count; ++i)
+        culled[i] = 0;
+        for (int p = 0; p < NumCullPlanes; ++p)
         {
-            const DebugPoint & point = debugPoints[i];
-            if (!point.depthEnabled)
+            if (lanes[0][p] * from[X] + lanes[1][p] * from[Y] + lanes[2][p] * from[Z] + lanes[3][p] < 0.0f &&
+                lanes[0][p] * to[X]   + lanes[1][p] * to[Y]   + lanes[2][p] * to[Z]   + lanes[3][p] < 0.0f)
             {
-                pushPointVert(DD_EXPLICIT_CONTEXT_ONLY(ctx,) point);
+                culled[i] = 1;
+                break;
             }
         }
-        flushDebugVerts(DD_EXPLICIT_CONTEXT_ONLY(ctx,) DrawModePoints, false);
     }
 }
 
-static void drawDebugLines(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx))
+#endif // DD_SIMD_*
+
+// ========================================================
+// Queued element storage:
+// ========================================================
+
+#ifdef DEBUG_DRAW_QUANTIZED_POSITIONS
+
+// Largest offset from a chunk origin that still fits in 16-bits.
+static const float MaxQuantizedOffset = 32767.0f * DEBUG_DRAW_QUANTIZATION_STEP;
+
+// Offsets out of the 16-bit range are clamped. Callers check isInQuantizedRange() first,
+// so this only guards the float to int16 conversion against rounding at the edges.
+static inline std::int16_t quantizeCoord(const float value, const float origin)
+{
+    float q = (value - origin) * (1.0f / DEBUG_DRAW_QUANTIZATION_STEP);
+    q = (q >= 0.0f) ? (q + 0.5f) : (q - 0.5f);
+    if (q >  32767.0f) { q =  32767.0f; }
+    if (q < -32767.0f) { q = -32767.0f; }
+    return static_cast<std::int16_t>(q);
+}
+
+static inline float dequantizeCoord(const std::int16_t q, const float origin)
+{
+    return origin + static_cast<float>(q) * DEBUG_DRAW_QUANTIZATION_STEP;
+}
+
+static inline bool isInQuantizedRange(const float origin[3], const float pos[3])
+{
+    return floatAbs(pos[X] - origin[X]) <= MaxQuantizedOffset &&
+           floatAbs(pos[Y] - origin[Y]) <= MaxQuantizedOffset &&
+           floatAbs(pos[Z] - origin[Z]) <= MaxQuantizedOffset;
+}
+
+// Origin of a chunk, set by its first element: the midpoint
+// of the element's positions, which for points is the point itself.
+static inline void getChunkOrigin(const float * positions, const int numPositions, float origin[3])
 {
-    const int count = DD_CONTEXT->debugLinesCount;
-    if (count == 0)
+    const float scale = 1.0f / static_cast<float>(numPositions);
+    vecSet(origin, 0.0f, 0.0f, 0.0f);
+    for (int i = 0; i < numPositions; ++i)
     {
-        return;
+        origin[X] += positions[i * 3 + X] * scale;
+        origin[Y] += positions[i * 3 + Y] * scale;
+        origin[Z] += positions[i * 3 + Z] * scale;
     }
+}
 
-    const DebugLine * const debugLines = DD_CONTEXT->debugLines;
+//
+// Points and lines too far from their chunk origin to be quantized keep their positions
+// as floats instead, in the room of two consecutive slots. The slots of the 'positions'
+// array of a chunk are used as follows, as told by its 'slotKinds':
+//
+static const std::uint8_t SlotQuantized = 0; // Offsets from the chunk origin.
+static const std::uint8_t SlotFloat     = 1; // Float positions, spilling over the next slot.
+static const std::uint8_t SlotFloatTail = 2; // End of the float positions of the previous slot. Not an element.
 
-    //
-    // First pass, lines with depth test ENABLED:
-    //
-    int numDepthlessLines = 0;
-    for (int i = 0; i < count; ++i)
+#endif // DEBUG_DRAW_QUANTIZED_POSITIONS
+
+//
+// With quantized positions, elements are only quantized if they are in range
+// of the origin of their chunk. Strings and shapes never have this restriction.
+//
+
+static inline bool fitsChunkOrigin(const DebugStringArray &, const float *, const int)
+{
+    return true;
+}
+
+static inline bool fitsChunkOrigin(const DebugShapeArrays &, const float *, const int)
+{
+    return true;
+}
+
+static inline bool fitsChunkOrigin(const DebugPointArrays & points, const float * positions, const int numPositions)
+{
+    #ifdef DEBUG_DRAW_QUANTIZED_POSITIONS
+    for (int i = 0; i < numPositions; ++i)
     {
-        const DebugLine & line = debugLines[i];
-        if (line.depthEnabled)
+        if (!isInQuantizedRange(points.origin, positions + i * 3))
         {
-            pushLineVert(DD_EXPLICIT_CONTEXT_ONLY(ctx,) line);
+            return false;
         }
-        numDepthlessLines += !line.depthEnabled;
     }
-    flushDebugVerts(DD_EXPLICIT_CONTEXT_ONLY(ctx,) DrawModeLines, true);
+    return true;
+    #else // !DEBUG_DRAW_QUANTIZED_POSITIONS
+    (void)points; (void)positions; (void)numPositions;
+    return true;
+    #endif // DEBUG_DRAW_QUANTIZED_POSITIONS
+}
 
-    //
-    // Second pass draws lines with depth DISABLED:
-    //
-    if (numDepthlessLines > 0)
+static inline bool fitsChunkOrigin(const DebugLineArrays & lines, const float * positions, const int numPositions)
+{
+    #ifdef DEBUG_DRAW_QUANTIZED_POSITIONS
+    for (int i = 0; i < numPositions; ++i)
     {
-        for (int i = 0; i < count; ++i)
+        if (!isInQuantizedRange(lines.origin, positions + i * 3))
         {
-            const DebugLine & line = debugLines[i];
-            if (!line.depthEnabled)
-            {
-                pushLineVert(DD_EXPLICIT_CONTEXT_ONLY(ctx,) line);
-            }
+            return false;
         }
-        flushDebugVerts(DD_EXPLICIT_CONTEXT_ONLY(ctx,) DrawModeLines, false);
     }
+    return true;
+    #else // !DEBUG_DRAW_QUANTIZED_POSITIONS
+    (void)lines; (void)positions; (void)numPositions;
+    return true;
+    #endif // DEBUG_DRAW_QUANTIZED_POSITIONS
 }
 
-template<typename T>
-static void clearDebugQueue(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) T * queue, int & queueCount)
+// Slots an element takes as the first of a new chunk. Its positions set the origin of
+// the chunk, but can still be too far apart to be quantized around their midpoint,
+// as with long lines, in which case they are kept as floats in two slots.
+static inline int getFirstElementSlots(const float * positions, const int numPositions)
 {
-    const std::int64_t time = DD_CONTEXT->currentTimeMillis;
-    if (time == 0)
+    #ifdef DEBUG_DRAW_QUANTIZED_POSITIONS
+    if (numPositions == 0)
     {
-        queueCount = 0;
-        return;
+        return 1;
     }
 
-    int index = 0;
-    T * pElem = queue;
-
-    // Concatenate elements that still need to be draw on future frames:
-    for (int i = 0; i < queueCount; ++i, ++pElem)
+    float origin[3];
+    getChunkOrigin(positions, numPositions, origin);
+    for (int i = 0; i < numPositions; ++i)
     {
-        if (pElem->expiryDateMillis > time)
+        if (!isInQuantizedRange(origin, positions + i * 3))
         {
-            if (index != i)
-            {
-                queue[index] = *pElem;
-            }
-            ++index;
+            return 2;
         }
     }
-
-    queueCount = index;
+    return 1;
+    #else // !DEBUG_DRAW_QUANTIZED_POSITIONS
+    (void)positions; (void)numPositions;
+    return 1;
+    #endif // DEBUG_DRAW_QUANTIZED_POSITIONS
 }
 
-static void setupGlyphTexture(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx))
+// Slots a new element takes if appended to 'chunk': two if its positions have
+// to be kept as floats, one otherwise. The first element of a chunk sets its origin.
+template<typename ChunkType>
+static inline int getElementSlots(const ChunkType * chunk, const float * positions, const int numPositions)
 {
-    if (DD_CONTEXT->renderInterface == nullptr)
+    if (chunk == nullptr || chunk->count == 0)
     {
-        return;
+        return getFirstElementSlots(positions, numPositions);
     }
+    return fitsChunkOrigin(chunk->elements, positions, numPositions) ? 1 : 2;
+}
 
-    if (DD_CONTEXT->glyphTexHandle != nullptr)
+// Tells if a slot holds an element, rather than the end of float positions.
+static inline bool isElementSlot(const DebugStringArray &, const int)
+{
+    return true;
+}
+
+static inline bool isElementSlot(const DebugShapeArrays &, const int)
+{
+    return true;
+}
+
+template<typename ArraysType>
+static inline bool isElementSlot(const ArraysType & elements, const int index)
+{
+    #ifdef DEBUG_DRAW_QUANTIZED_POSITIONS
+    return elements.slotKinds[index] != SlotFloatTail;
+    #else // !DEBUG_DRAW_QUANTIZED_POSITIONS
+    (void)elements; (void)index;
+    return true;
+    #endif // DEBUG_DRAW_QUANTIZED_POSITIONS
+}
+
+// Slot just past the 'numElements' points or lines that start at 'slot'.
+template<typename ArraysType>
+static inline int getElementsEndSlot(const ArraysType & elements, int slot, int numElements)
+{
+    #ifdef DEBUG_DRAW_QUANTIZED_POSITIONS
+    for (; numElements > 0; --numElements)
     {
-        DD_CONTEXT->renderInterface->destroyGlyphTexture(DD_CONTEXT->glyphTexHandle);
-        DD_CONTEXT->glyphTexHandle = nullptr;
+        slot += (elements.slotKinds[slot] == SlotFloat) ? 2 : 1;
     }
+    return slot;
+    #else // !DEBUG_DRAW_QUANTIZED_POSITIONS
+    (void)elements;
+    return slot + numElements;
+    #endif // DEBUG_DRAW_QUANTIZED_POSITIONS
+}
 
-    std::uint8_t * decompressedBitmap = decompressFontBitmap();
-    if (decompressedBitmap == nullptr)
+// Counts a new element pushed to the queue. Elements count once, however many slots they take.
+template<typename ArraysType>
+static inline void countQueuedElement(DebugQueue<ArraysType> & queue, const int partition)
+{
+    ++queue.partitionCounts[partition];
+    if (++queue.count > queue.highWaterCount)
     {
-        return; // Failed to decompressed. No font rendering available.
+        queue.highWaterCount = queue.count;
     }
-
-    DD_CONTEXT->glyphTexHandle = DD_CONTEXT->renderInterface->createGlyphTexture(
-                                        getFontCharSet().bitmapWidth,
-                                        getFontCharSet().bitmapHeight,
-                                        decompressedBitmap);
-
-    // No longer needed.
-    DD_MFREE(decompressedBitmap);
 }
 
-// ========================================================
-// Public Debug Draw interface:
-// ========================================================
+// Tells if the queue has elements in either partition of a render layer.
+template<typename ArraysType>
+static inline bool hasLayerElements(const DebugQueue<ArraysType> & queue, const int layer)
+{
+    return (queue.partitionCounts[getQueuePartition(layer, true)] + queue.partitionCounts[getQueuePartition(layer, false)]) != 0;
+}
 
-bool initialize(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle * outCtx,) RenderInterface * renderer)
+// Appends the slots of a new element to the end of one of the chunk lists of the queue,
+// taking new chunks from 'pool'. Returns the chunk holding the slots, or null if the queue
+// is full. 'numSlots' is set to the number of slots the element takes.
+template<typename ArraysType, typename ChunkType>
+static ChunkType * pushQueueListSlot(DebugQueue<ArraysType> & queue, DebugChunkList<ChunkType> & list, ChunkType *& pool,
+                                     int & numAllocated, const float * positions, const int numPositions,
+                                     int & numSlots, int & outIndex)
 {
-    if (renderer == nullptr)
+    // Elements that don't fit in the tail chunk start a new one, and are measured against its origin instead.
+    numSlots = getElementSlots(list.tail, positions, numPositions);
+    const bool newChunk = (list.tail == nullptr || list.tail->count + numSlots > DEBUG_DRAW_QUEUE_CHUNK_SIZE);
+    if (newChunk)
     {
-        return false;
+        numSlots = getFirstElementSlots(positions, numPositions);
     }
-
-    void * buffer = DD_MALLOC(sizeof(InternalContext));
-    if (buffer == nullptr)
+    if (!queue.growable && queue.count >= queue.capacity)
     {
-        return false;
+        return nullptr;
     }
 
-    InternalContext * newCtx = ::new(buffer) InternalContext(renderer);
+    return pushChunkListSlot(list, pool, queue.allocator, numAllocated, newChunk, numSlots, outIndex);
+}
 
-    #ifdef DEBUG_DRAW_EXPLICIT_CONTEXT
-    if ((*outCtx) != nullptr) { shutdown(*outCtx); }
-    (*outCtx) = newCtx;
+static inline std::int64_t getExpiryWindowMillis(const int level)
+{
+    return static_cast<std::int64_t>(DEBUG_DRAW_EXPIRY_WINDOW_MILLIS) << (level * ExpiryLevelShift);
+}
+
+static inline std::int64_t getExpiryWindowIndex(const std::int64_t dateMillis, const int level)
+{
+    // Rounds towards negative infinity, since dates can be negative.
+    const std::int64_t windowMillis = getExpiryWindowMillis(level);
+    std::int64_t index = dateMillis / windowMillis;
+    if ((dateMillis % windowMillis) < 0)
+    {
+        --index;
+    }
+    return index;
+}
+
+// Level of the bucket for elements expiring at 'expiryDateMillis': the coarsest
+// level whose window for that date starts after 'currentTimeMillis'.
+static int getExpiryLevel(const std::int64_t expiryDateMillis, const std::int64_t currentTimeMillis)
+{
+    for (int level = NumExpiryLevels - 1; level > 0; --level)
+    {
+        if (getExpiryWindowIndex(expiryDateMillis, level) > getExpiryWindowIndex(currentTimeMillis, level))
+        {
+            return level;
+        }
+    }
+    return 0;
+}
+
+// Finds the bucket for elements expiring at 'expiryDateMillis', adding
+// it to the queue if needed. Returns null if out of memory.
+template<typename ArraysType>
+static typename DebugQueue<ArraysType>::Bucket * findExpiryBucket(DebugQueue<ArraysType> & queue, const std::int64_t expiryDateMillis,
+                                                                  const std::int64_t currentTimeMillis)
+{
+    typedef typename DebugQueue<ArraysType>::Bucket Bucket;
+
+    // Most draws in a row share the same duration, so they land in the same bucket.
+    Bucket * bucket = queue.lastBucket;
+    if (bucket != nullptr && bucket->windowStart <= expiryDateMillis && expiryDateMillis <= bucket->windowEnd)
+    {
+        return bucket;
+    }
+
+    Bucket * prev = nullptr;
+    bucket = queue.buckets;
+    while (bucket != nullptr && bucket->windowEnd < expiryDateMillis)
+    {
+        prev   = bucket;
+        bucket = bucket->next;
+    }
+
+    if (bucket == nullptr || bucket->windowStart > expiryDateMillis)
+    {
+        // Windows of all levels are aligned to their width, so a finer window always fits between
+        // the neighbors. Only needed if the time went backwards since the neighbors were added.
+        int level = getExpiryLevel(expiryDateMillis, currentTimeMillis);
+        std::int64_t windowStart, windowEnd;
+        for (;; --level)
+        {
+            windowStart = getExpiryWindowIndex(expiryDateMillis, level) * getExpiryWindowMillis(level);
+            windowEnd   = windowStart + getExpiryWindowMillis(level) - 1;
+            if (level == 0 || ((prev == nullptr || prev->windowEnd < windowStart) &&
+                               (bucket == nullptr || bucket->windowStart > windowEnd)))
+            {
+                break;
+            }
+        }
+
+        Bucket * newBucket = queue.freeBuckets;
+        if (newBucket != nullptr)
+        {
+            queue.freeBuckets = newBucket->next;
+        }
+        else if ((newBucket = static_cast<Bucket *>(allocMemory(queue.allocator, sizeof(Bucket),
+                                                                alignof(Bucket), AllocTagQueue))) == nullptr)
+        {
+            return nullptr;
+        }
+        else
+        {
+            ++queue.numBuckets;
+        }
+
+        newBucket->next             = bucket;
+        newBucket->windowStart      = windowStart;
+        newBucket->windowEnd        = windowEnd;
+        newBucket->lastExpiryMillis = windowStart;
+        newBucket->level            = level;
+        newBucket->count            = 0;
+        for (int p = 0; p < NumQueuePartitions; ++p)
+        {
+            newBucket->chunks[p].head  = nullptr;
+            newBucket->chunks[p].tail  = nullptr;
+            newBucket->chunks[p].count = 0;
+        }
+
+        if (prev != nullptr)
+        {
+            prev->next = newBucket;
+        }
+        else
+        {
+            queue.buckets = newBucket;
+        }
+        bucket = newBucket;
+    }
+
+    queue.lastBucket = bucket;
+    return bucket;
+}
+
+// Appends the slots of a new element expiring at 'expiryDateMillis' to the given partition
+// of a bucket. Returns the chunk holding the slots, or null if the queue is full.
+template<typename ArraysType>
+static typename DebugQueue<ArraysType>::TimedChunk * pushBucketSlot(DebugQueue<ArraysType> & queue,
+                                                                    typename DebugQueue<ArraysType>::Bucket & bucket,
+                                                                    const int partition, const std::int64_t expiryDateMillis,
+                                                                    const float * positions, const int numPositions,
+                                                                    int & outIndex)
+{
+    int numSlots;
+    typename DebugQueue<ArraysType>::TimedChunk * chunk = pushQueueListSlot(queue, bucket.chunks[partition], queue.freeTimedChunks,
+                                                                            queue.numTimedChunks, positions, numPositions,
+                                                                            numSlots, outIndex);
+    if (chunk == nullptr)
+    {
+        return nullptr;
+    }
+
+    for (int s = 0; s < numSlots; ++s)
+    {
+        chunk->expiryDateMillis[outIndex + s] = expiryDateMillis;
+    }
+    if (expiryDateMillis > bucket.lastExpiryMillis)
+    {
+        bucket.lastExpiryMillis = expiryDateMillis;
+    }
+
+    ++bucket.count;
+    countQueuedElement(queue, partition);
+    return chunk;
+}
+
+// Appends a new element slot to the given partition of the queue. Elements with no duration
+// go to the transient list, others to the bucket of their expiry date. Returns the arrays
+// holding the slot and its index within them, or null if the queue is full. 'positions' are
+// the XYZ world positions of the new element (one for points, two for lines), if it has any,
+// which must then be stored with storePositions() before the next push.
+template<typename ArraysType>
+static ArraysType * pushQueueSlot(DebugQueue<ArraysType> & queue, const int partition, const std::int64_t currentTimeMillis,
+                                  const int durationMillis, const float * positions, const int numPositions,
+                                  int & outIndex)
+{
+    if (durationMillis <= 0)
+    {
+        int numSlots;
+        typename DebugQueue<ArraysType>::Chunk * chunk = pushQueueListSlot(queue, queue.transient[partition], queue.freeChunks,
+                                                                           queue.numChunks, positions, numPositions,
+                                                                           numSlots, outIndex);
+        if (chunk == nullptr)
+        {
+            return nullptr;
+        }
+
+        ++queue.transientCount;
+        countQueuedElement(queue, partition);
+        return &chunk->elements;
+    }
+
+    const std::int64_t expiryDateMillis = currentTimeMillis + durationMillis;
+    typename DebugQueue<ArraysType>::Bucket * bucket = findExpiryBucket(queue, expiryDateMillis, currentTimeMillis);
+    if (bucket == nullptr)
+    {
+        return nullptr;
+    }
+
+    // If this fails the bucket is left empty, which is harmless. It will be freed once expired.
+    typename DebugQueue<ArraysType>::TimedChunk * chunk = pushBucketSlot(queue, *bucket, partition, expiryDateMillis,
+                                                                         positions, numPositions, outIndex);
+    return (chunk != nullptr) ? &chunk->elements : nullptr;
+}
+
+// Store 'numPositions' XYZ positions for the element at 'index'. The first element stored
+// in a chunk defines the origin for quantization. Positions out of range of the origin
+// are stored as floats in two slots, as getElementSlots() made room for.
+template<typename ArraysType>
+static inline void storePositions(ArraysType & elements, const int index, const float * positions, const int numPositions)
+{
+    #ifdef DEBUG_DRAW_QUANTIZED_POSITIONS
+    if (index == 0)
+    {
+        getChunkOrigin(positions, numPositions, elements.origin);
+    }
+    if (!fitsChunkOrigin(elements, positions, numPositions))
+    {
+        elements.slotKinds[index]     = SlotFloat;
+        elements.slotKinds[index + 1] = SlotFloatTail;
+        std::memcpy(elements.positions + index, positions, numPositions * 3 * sizeof(float));
+        return;
+    }
+
+    std::int16_t * const position = elements.positions[index];
+    for (int c = 0; c < numPositions * 3; ++c)
+    {
+        position[c] = quantizeCoord(positions[c], elements.origin[c % 3]);
+    }
+    elements.slotKinds[index] = SlotQuantized;
+    #else // !DEBUG_DRAW_QUANTIZED_POSITIONS
+    float * const position = elements.positions[index];
+    for (int c = 0; c < numPositions * 3; ++c)
+    {
+        position[c] = positions[c];
+    }
+    #endif // DEBUG_DRAW_QUANTIZED_POSITIONS
+}
+
+// Load 'numPositions' XYZ positions of the element at 'index' back into 'result'.
+template<typename ArraysType>
+static inline void loadPositions(const ArraysType & elements, const int index, float * result, const int numPositions)
+{
+    #ifdef DEBUG_DRAW_QUANTIZED_POSITIONS
+    if (elements.slotKinds[index] == SlotFloat)
+    {
+        std::memcpy(result, elements.positions + index, numPositions * 3 * sizeof(float));
+        return;
+    }
+
+    const std::int16_t * const position = elements.positions[index];
+    for (int c = 0; c < numPositions * 3; ++c)
+    {
+        result[c] = dequantizeCoord(position[c], elements.origin[c % 3]);
+    }
+    #else // !DEBUG_DRAW_QUANTIZED_POSITIONS
+    const float * const position = elements.positions[index];
+    for (int c = 0; c < numPositions * 3; ++c)
+    {
+        result[c] = position[c];
+    }
+    #endif // DEBUG_DRAW_QUANTIZED_POSITIONS
+}
+
+// ========================================================
+// ddMat4x4 helpers:
+// ========================================================
+
+static inline void matTransformPointXYZ(ddVec3_Out result, ddVec3_In p, ddMat4x4_In m)
+{
+    result[X] = (m[0] * p[X]) + (m[4] * p[Y]) + (m[8]  * p[Z]) + m[12]; // p[W] assumed to be 1
+    result[Y] = (m[1] * p[X]) + (m[5] * p[Y]) + (m[9]  * p[Z]) + m[13];
+    result[Z] = (m[2] * p[X]) + (m[6] * p[Y]) + (m[10] * p[Z]) + m[14];
+}
+
+static inline void matTransformPointXYZW(float result[4], ddVec3_In p, ddMat4x4_In m)
+{
+    result[X] = (m[0] * p[X]) + (m[4] * p[Y]) + (m[8]  * p[Z]) + m[12]; // p[W] assumed to be 1
+    result[Y] = (m[1] * p[X]) + (m[5] * p[Y]) + (m[9]  * p[Z]) + m[13];
+    result[Z] = (m[2] * p[X]) + (m[6] * p[Y]) + (m[10] * p[Z]) + m[14];
+    result[W] = (m[3] * p[X]) + (m[7] * p[Y]) + (m[11] * p[Z]) + m[15];
+}
+
+static inline float matTransformPointXYZW2(ddVec3_Out result, const float p[3], ddMat4x4_In m)
+{
+    result[X] = (m[0] * p[X]) + (m[4] * p[Y]) + (m[8]  * p[Z]) + m[12]; // p[W] assumed to be 1
+    result[Y] = (m[1] * p[X]) + (m[5] * p[Y]) + (m[9]  * p[Z]) + m[13];
+    result[Z] = (m[2] * p[X]) + (m[6] * p[Y]) + (m[10] * p[Z]) + m[14];
+    float rw  = (m[3] * p[X]) + (m[7] * p[Y]) + (m[11] * p[Z]) + m[15];
+    return rw;
+}
+
+// ========================================================
+// Shape generators:
+// ========================================================
+
+//
+// The shapes made of many lines are generated through a line sink, so the same code
+// can queue their lines, expand the queued shapes when drawn or build the unit meshes
+// of the instanced shapes.
+//
+
+// Sends the lines of a shape to the draw queues, as dd::line() does.
+struct QueueLineSink
+{
+    DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx;)
+    ddVec3 color;
+    int    durationMillis;
+    bool   depthEnabled;
+
+    QueueLineSink(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle context,) ddVec3_In lineColor, const int duration, const bool depth)
+        : DD_EXPLICIT_CONTEXT_ONLY(ctx(context),)
+          durationMillis(duration)
+        , depthEnabled(depth)
+    {
+        vecCopy(color, lineColor);
+    }
+
+    void operator()(ddVec3_In from, ddVec3_In to) const
+    {
+        line(DD_EXPLICIT_CONTEXT_ONLY(ctx,) from, to, color, durationMillis, depthEnabled);
+    }
+};
+
+// Most vertexes of a unit shape mesh. The sphere has the most lines.
+static const int MaxShapeMeshVertexes = (360 / 15) * (360 / 15) * 4;
+
+// Appends the lines of a shape to a dd::ShapeMesh under construction.
+struct MeshLineSink
+{
+    float * positions;   // Room for MaxShapeMeshVertexes XYZ positions.
+    int     vertexCount;
+
+    void operator()(ddVec3_In from, ddVec3_In to)
+    {
+        if (vertexCount + 2 <= MaxShapeMeshVertexes)
+        {
+            float * dest = positions + vertexCount * 3;
+            for (int c = 0; c < 3; ++c)
+            {
+                dest[c]     = from[c];
+                dest[c + 3] = to[c];
+            }
+            vertexCount += 2;
+        }
+    }
+};
+
+// The shapes made of circles take a table of 'numSteps' + 1 points around the unit circle,
+// e.g. unitCircle15Deg with 24 steps. Capsule caps need a multiple of 4 steps.
+static const int MaxShapeSteps = 48;
+
+// Steps around a shape that the screen-space LOD picks from, each with its
+// chord error, i.e. 1 - cos(PI / steps): how far the middle of a line is
+// inside the true circle, relative to the radius.
+static const int   NumLodLevels = 5;
+static const int   lodLevelSteps[NumLodLevels]  = { 4, 8, 12, 24, MaxShapeSteps };
+static const float lodChordErrors[NumLodLevels] = { 0.292893219f, 0.076120467f, 0.034074174f, 0.008555139f, 0.002141077f };
+
+// Fewest steps around that keep the shape placed by 'transform' within
+// DEBUG_DRAW_LOD_PIXEL_ERROR pixels of its outline. 'pixelScaleSq' is the
+// squared size in pixels of one world unit at a clip space W of one.
+// Returns 0 to keep the fixed steps if the shape is at or behind the eye.
+static int getShapeLodSteps(const float transform[12], const float viewProj[16], const float pixelScaleSq)
+{
+    const float w = viewProj[3]  * transform[9]  +
+                    viewProj[7]  * transform[10] +
+                    viewProj[11] * transform[11] +
+                    viewProj[15];
+    if (w <= FloatEpsilon)
+    {
+        return 0;
+    }
+
+    // Compare squared sizes to skip the square roots: (radius * pixelScale / w) * chordError <= error.
+    const float xLengthSq = transform[0] * transform[0] + transform[1] * transform[1] + transform[2] * transform[2];
+    const float yLengthSq = transform[3] * transform[3] + transform[4] * transform[4] + transform[5] * transform[5];
+    const float radiusPixelsSq = ((xLengthSq > yLengthSq) ? xLengthSq : yLengthSq) * pixelScaleSq;
+    const float maxErrorSq = (DEBUG_DRAW_LOD_PIXEL_ERROR * w) * (DEBUG_DRAW_LOD_PIXEL_ERROR * w);
+
+    for (int level = 0; level < NumLodLevels; ++level)
+    {
+        if (radiusPixelsSq * lodChordErrors[level] * lodChordErrors[level] <= maxErrorSq)
+        {
+            return lodLevelSteps[level];
+        }
+    }
+    return MaxShapeSteps;
+}
+
+// Fills 'numSteps' + 1 points around the unit circle, starting and ending at angle zero.
+static void fillUnitCircle(SinCos * circle, const int numSteps)
+{
+    const float stepS = floatSin(TAU / numSteps);
+    const float stepC = floatCos(TAU / numSteps);
+    float s = 0.0f;
+    float c = 1.0f;
+
+    for (int i = 0; i < numSteps; ++i)
+    {
+        circle[i].s = s;
+        circle[i].c = c;
+        rotateSinCos(s, c, stepS, stepC);
+    }
+    circle[numSteps] = circle[0];
+}
+
+template<typename LineSink>
+static void sphereLines(LineSink & sink, ddVec3_In center, const float radius, const SinCos * circle, const int numSteps)
+{
+    ddVec3 cache[MaxShapeSteps];
+    ddVec3 radiusVec;
+
+    vecSet(radiusVec, 0.0f, 0.0f, radius);
+    vecAdd(cache[0], center, radiusVec);
+
+    for (int n = 1; n < numSteps; ++n)
+    {
+        vecCopy(cache[n], cache[0]);
+    }
+
+    ddVec3 lastPoint, temp;
+    for (int i = 1; i <= numSteps; ++i)
+    {
+        const float s = circle[i].s;
+        const float c = circle[i].c;
+
+        lastPoint[X] = center[X];
+        lastPoint[Y] = center[Y] + radius * s;
+        lastPoint[Z] = center[Z] + radius * c;
+
+        for (int n = 0; n < numSteps; ++n)
+        {
+            temp[X] = center[X] + circle[n + 1].s * radius * s;
+            temp[Y] = center[Y] + circle[n + 1].c * radius * s;
+            temp[Z] = lastPoint[Z];
+
+            sink(lastPoint, temp);
+            sink(lastPoint, cache[n]);
+
+            vecCopy(cache[n], lastPoint);
+            vecCopy(lastPoint, temp);
+        }
+    }
+}
+
+template<typename LineSink>
+static void coneLines(LineSink & sink, ddVec3_In apex, ddVec3_In top, ddVec3_In xAxis, ddVec3_In yAxis,
+                      const float baseRadius, const float apexRadius, const SinCos * circle, const int numSteps)
+{
+    ddVec3 temp0, temp1, temp2;
+    ddVec3 p1, p2, lastP1, lastP2;
+
+    vecScale(temp1, yAxis, baseRadius);
+    vecAdd(lastP2, top, temp1);
+
+    if (apexRadius == 0.0f)
+    {
+        for (int i = 1; i <= numSteps; ++i)
+        {
+            vecScale(temp1, xAxis, circle[i].s);
+            vecScale(temp2, yAxis, circle[i].c);
+            vecAdd(temp0, temp1, temp2);
+
+            vecScale(temp0, temp0, baseRadius);
+            vecAdd(p2, top, temp0);
+
+            sink(lastP2, p2);
+            sink(p2, apex);
+
+            vecCopy(lastP2, p2);
+        }
+    }
+    else // A degenerate cone with open apex:
+    {
+        vecScale(temp1, yAxis, apexRadius);
+        vecAdd(lastP1, apex, temp1);
+
+        for (int i = 1; i <= numSteps; ++i)
+        {
+            vecScale(temp1, xAxis, circle[i].s);
+            vecScale(temp2, yAxis, circle[i].c);
+            vecAdd(temp0, temp1, temp2);
+
+            vecScale(temp1, temp0, apexRadius);
+            vecScale(temp2, temp0, baseRadius);
+
+            vecAdd(p1, apex, temp1);
+            vecAdd(p2, top,  temp2);
+
+            sink(lastP1, p1);
+            sink(lastP2, p2);
+            sink(p1, p2);
+
+            vecCopy(lastP1, p1);
+            vecCopy(lastP2, p2);
+        }
+    }
+}
+
+// 'left' and 'up' are scaled by the circle radius.
+template<typename LineSink>
+static void circleLines(LineSink & sink, ddVec3_In center, ddVec3_In left, ddVec3_In up, const float numSteps)
+{
+    ddVec3 point, lastPoint;
+
+    vecAdd(lastPoint, center, up);
+
+    // Rotate the unit vector by a fixed step instead of evaluating sin/cos per point.
+    const float stepS = floatSin(TAU / numSteps);
+    const float stepC = floatCos(TAU / numSteps);
+    float s = 0.0f;
+    float c = 1.0f;
+
+    for (int i = 1; i <= numSteps; ++i)
+    {
+        rotateSinCos(s, c, stepS, stepC);
+
+        ddVec3 vs, vc;
+        vecScale(vs, left, s);
+        vecScale(vc, up,   c);
+
+        vecAdd(point, center, vs);
+        vecAdd(point, point,  vc);
+
+        sink(lastPoint, point);
+        vecCopy(lastPoint, point);
+    }
+}
+
+// Sides of a capsule: circles around 'p1' and 'p2', joined by lines.
+// 'u' and 'v' are unit vectors perpendicular to each other and to the capsule's axis.
+template<typename LineSink>
+static void capsuleBodyLines(LineSink & sink, ddVec3_In p1, ddVec3_In p2, ddVec3_In u, ddVec3_In v, const float radius,
+                             const SinCos * circle, const int numSteps)
+{
+    // Draw the cylinder
+    for (int j = 0; j < numSteps; ++j)
+    {
+        ddVec3 point1, point2, point3, point4;
+
+        float c = circle[j].c;
+        float s = circle[j].s;
+        float c2 = circle[j + 1].c;
+        float s2 = circle[j + 1].s;
+
+        // Circle at p1
+        vecSet(point1, p1[X] + radius * (c * u[X] + s * v[X]),
+            p1[Y] + radius * (c * u[Y] + s * v[Y]),
+            p1[Z] + radius * (c * u[Z] + s * v[Z]));
+        vecSet(point2, p1[X] + radius * (c2 * u[X] + s2 * v[X]),
+            p1[Y] + radius * (c2 * u[Y] + s2 * v[Y]),
+            p1[Z] + radius * (c2 * u[Z] + s2 * v[Z]));
+        sink(point1, point2);
+
+        // Circle at p2
+        vecSet(point3, p2[X] + radius * (c * u[X] + s * v[X]),
+            p2[Y] + radius * (c * u[Y] + s * v[Y]),
+            p2[Z] + radius * (c * u[Z] + s * v[Z]));
+        vecSet(point4, p2[X] + radius * (c2 * u[X] + s2 * v[X]),
+            p2[Y] + radius * (c2 * u[Y] + s2 * v[Y]),
+            p2[Z] + radius * (c2 * u[Z] + s2 * v[Z]));
+        sink(point3, point4);
+
+        // Connecting line between circles
+        sink(point1, point3);
+    }
+}
+
+// Half sphere around 'p' on the side of the unit vector 'd', with 'u' and 'v' as above.
+template<typename LineSink>
+static void capsuleCapLines(LineSink & sink, ddVec3_In p, ddVec3_In d, ddVec3_In u, ddVec3_In v, const float radius,
+                            const SinCos * circle, const int numSteps)
+{
+    const int quarterSteps = numSteps / 4;
+
+    for (int i = 0; i <= quarterSteps; ++i)
+    {
+        float s = circle[i].s;
+        float c = circle[i].c;
+
+        for (int j = 0; j < numSteps; ++j)
+        {
+            const SinCos & theta  = circle[j];
+            const SinCos & theta2 = circle[j + 1];
+            ddVec3 point1, point2;
+
+            vecSet(point1, p[X] + radius * (s * theta.c * u[X] + s * theta.s * v[X] + c * d[X]),
+                p[Y] + radius * (s * theta.c * u[Y] + s * theta.s * v[Y] + c * d[Y]),
+                p[Z] + radius * (s * theta.c * u[Z] + s * theta.s * v[Z] + c * d[Z]));
+            vecSet(point2, p[X] + radius * (s * theta2.c * u[X] + s * theta2.s * v[X] + c * d[X]),
+                p[Y] + radius * (s * theta2.c * u[Y] + s * theta2.s * v[Y] + c * d[Y]),
+                p[Z] + radius * (s * theta2.c * u[Z] + s * theta2.s * v[Z] + c * d[Z]));
+            sink(point1, point2);
+
+            if (i < quarterSteps)
+            {
+                float s2 = circle[i + 1].s;
+                float c2 = circle[i + 1].c;
+                ddVec3 point3;
+                vecSet(point3, p[X] + radius * (s2 * theta.c * u[X] + s2 * theta.s * v[X] + c2 * d[X]),
+                    p[Y] + radius * (s2 * theta.c * u[Y] + s2 * theta.s * v[Y] + c2 * d[Y]),
+                    p[Z] + radius * (s2 * theta.c * u[Z] + s2 * theta.s * v[Z] + c2 * d[Z]));
+                sink(point1, point3);
+            }
+        }
+    }
+}
+
+// Edges of a box. The axes go from 'center' to the middle of its faces.
+template<typename LineSink>
+static void boxLines(LineSink & sink, ddVec3_In center, ddVec3_In xAxis, ddVec3_In yAxis, ddVec3_In zAxis)
+{
+    // Corners of the top face (+Y) first, then the bottom one, in the same order.
+    static const float signs[4][2] = { { -1.0f, 1.0f }, { -1.0f, -1.0f }, { 1.0f, -1.0f }, { 1.0f, 1.0f } };
+
+    ddVec3 points[8];
+    for (int i = 0; i < 4; ++i)
+    {
+        for (int c = 0; c < 3; ++c)
+        {
+            const float xz = center[c] + signs[i][0] * xAxis[c] + signs[i][1] * zAxis[c];
+            points[i][c]     = xz + yAxis[c];
+            points[4 + i][c] = xz - yAxis[c];
+        }
+    }
+
+    for (int i = 0; i < 4; ++i)
+    {
+        sink(points[i], points[(i + 1) & 3]);
+        sink(points[4 + i], points[4 + ((i + 1) & 3)]);
+        sink(points[i], points[4 + i]);
+    }
+}
+
+// Arrowhead with its tip at 'apex' and the center of its base at 'base'.
+// 'right' and 'up' are scaled by the radius of the base.
+template<typename LineSink>
+static void arrowHeadLines(LineSink & sink, ddVec3_In apex, ddVec3_In base, ddVec3_In right, ddVec3_In up)
+{
+    static const int stepSize = 30; // Every other step of unitCircle15Deg
+    ddVec3 v1, v2;
+
+    for (int i = 0; i < 360; i += stepSize)
+    {
+        const SinCos & a = unitCircle15Deg[i / 15];
+        const SinCos & b = unitCircle15Deg[(i + stepSize) / 15];
+        for (int c = 0; c < 3; ++c)
+        {
+            v1[c] = base[c] + right[c] * a.c + up[c] * a.s;
+            v2[c] = base[c] + right[c] * b.c + up[c] * b.s;
+        }
+
+        sink(v1, apex);
+        sink(v1, v2);
+    }
+}
+
+// Lines of a queued shape, i.e. its unit mesh placed by a dd::ShapeInstance transform.
+// 'lodSteps' from getShapeLodSteps() overrides the fixed steps of the round shapes if not zero.
+template<typename LineSink>
+static void shapeLines(LineSink & sink, const int shape, const float transform[12], const int lodSteps = 0)
+{
+    const SinCos * circle15Deg = unitCircle15Deg;
+    const SinCos * circle20Deg = unitCircle20Deg;
+    int steps15Deg = 24;
+    int steps20Deg = 18;
+
+    SinCos lodCircle[MaxShapeSteps + 1];
+    if (lodSteps != 0 && shape != ShapeCircle && shape != ShapeBox && shape != ShapeArrowHead)
+    {
+        if (lodSteps != steps15Deg)
+        {
+            fillUnitCircle(lodCircle, lodSteps);
+            circle15Deg = lodCircle;
+        }
+        circle20Deg = circle15Deg;
+        steps15Deg  = lodSteps;
+        steps20Deg  = lodSteps;
+    }
+
+    ddVec3 xAxis, yAxis, zAxis, origin, end;
+    vecSet(xAxis,  transform[0], transform[1],  transform[2]);
+    vecSet(yAxis,  transform[3], transform[4],  transform[5]);
+    vecSet(zAxis,  transform[6], transform[7],  transform[8]);
+    vecSet(origin, transform[9], transform[10], transform[11]);
+    vecAdd(end, origin, zAxis);
+
+    switch (shape)
+    {
+    case ShapeSphere      : sphereLines(sink, origin, xAxis[X], circle15Deg, steps15Deg); break; // Always uniformly scaled.
+    case ShapeCone        : coneLines(sink, origin, end, xAxis, yAxis, 1.0f, 0.0f, circle20Deg, steps20Deg); break;
+    case ShapeCircle      : circleLines(sink, origin, xAxis, yAxis, static_cast<float>(lodSteps != 0 ? lodSteps : ShapeCircleSteps)); break;
+    case ShapeCapsuleBody : capsuleBodyLines(sink, origin, end, xAxis, yAxis, 1.0f, circle15Deg, steps15Deg); break;
+    case ShapeCapsuleCap  : capsuleCapLines(sink, origin, zAxis, xAxis, yAxis, 1.0f, circle15Deg, steps15Deg); break;
+    case ShapeBox         : boxLines(sink, origin, xAxis, yAxis, zAxis); break;
+    case ShapeArrowHead   : arrowHeadLines(sink, origin, end, xAxis, yAxis); break;
+    } // switch (shape)
+}
+
+// Number of lines shapeLines() generates for a shape, without generating them.
+static int getShapeLineCount(const int shape, const int lodSteps = 0)
+{
+    const int steps15Deg = (lodSteps != 0) ? lodSteps : 24;
+    const int steps20Deg = (lodSteps != 0) ? lodSteps : 18;
+
+    switch (shape)
+    {
+    case ShapeSphere      : return steps15Deg * steps15Deg * 2;
+    case ShapeCone        : return steps20Deg * 2;
+    case ShapeCircle      : return (lodSteps != 0) ? lodSteps : ShapeCircleSteps;
+    case ShapeCapsuleBody : return steps15Deg * 3;
+    case ShapeCapsuleCap  : return steps15Deg * ((steps15Deg / 4) * 2 + 1);
+    case ShapeBox         : return 12;
+    case ShapeArrowHead   : return 24;
+    } // switch (shape)
+    return 0;
+}
+
+// Hands the unit mesh of every dd::ShapeId to the renderer. Returns false if out of memory.
+static bool createShapeMeshes(RenderInterface * renderer, Allocator * allocator)
+{
+    const std::size_t meshBytes = sizeof(float) * 3 * MaxShapeMeshVertexes;
+    MeshLineSink mesh;
+    mesh.positions = static_cast<float *>(allocMemory(allocator, meshBytes, alignof(float), AllocTagShapeMeshes));
+    if (mesh.positions == nullptr)
+    {
+        return false;
+    }
+
+    static const float identity[12] = { 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f };
+
+    for (int shape = 0; shape < ShapeCount; ++shape)
+    {
+        mesh.vertexCount = 0;
+        shapeLines(mesh, shape, identity);
+
+        ShapeMesh shapeMesh;
+        shapeMesh.positions   = mesh.positions;
+        shapeMesh.vertexCount = mesh.vertexCount;
+        renderer->createShapeMesh(static_cast<ShapeId>(shape), shapeMesh);
+    }
+
+    freeMemory(allocator, mesh.positions, meshBytes, AllocTagShapeMeshes);
+    return true;
+}
+
+// ========================================================
+// Submission-time culling:
+// ========================================================
+
+//
+// Shapes with no duration are tested against the planes from dd::setCullingPlanes()
+// before any of their lines are generated. Each test is conservative: it only culls
+// if the whole volume is behind a single plane, so shapes near the frustum corners
+// may still be drawn.
+//
+
+static bool isSubmissionCullable(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const int durationMillis)
+{
+    return DD_CONTEXT->cullingEnabled && durationMillis == 0;
+}
+
+static bool isSphereCulled(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) ddVec3_In center, const float radius)
+{
+    for (int i = 0; i < 6; ++i)
+    {
+        const float * plane = DD_CONTEXT->cullPlanes[i];
+        if (plane[0] * center[X] + plane[1] * center[Y] + plane[2] * center[Z] + plane[3] < -radius)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Box given by its center and half extent axes, as the ShapeBox instances.
+static bool isBoxCulled(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) ddVec3_In center,
+                        ddVec3_In xAxis, ddVec3_In yAxis, ddVec3_In zAxis)
+{
+    for (int i = 0; i < 6; ++i)
+    {
+        const float * plane = DD_CONTEXT->cullPlanes[i];
+        const float radius = floatAbs(plane[0] * xAxis[X] + plane[1] * xAxis[Y] + plane[2] * xAxis[Z]) +
+                             floatAbs(plane[0] * yAxis[X] + plane[1] * yAxis[Y] + plane[2] * yAxis[Z]) +
+                             floatAbs(plane[0] * zAxis[X] + plane[1] * zAxis[Y] + plane[2] * zAxis[Z]);
+        if (plane[0] * center[X] + plane[1] * center[Y] + plane[2] * center[Z] + plane[3] < -radius)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool arePointsCulled(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const ddVec3 * points, const int count)
+{
+    for (int i = 0; i < 6; ++i)
+    {
+        const float * plane = DD_CONTEXT->cullPlanes[i];
+        int outside = 0;
+        while (outside < count &&
+               plane[0] * points[outside][X] + plane[1] * points[outside][Y] + plane[2] * points[outside][Z] + plane[3] < 0.0f)
+        {
+            ++outside;
+        }
+        if (outside == count)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Queued shape, tested by the box its unit mesh fits in, placed by its 3x4 transform.
+static bool isShapeCulled(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const int shape, const float transform[12])
+{
+    ddVec3 xAxis, yAxis, zAxis, center;
+    vecSet(xAxis,  transform[0], transform[1],  transform[2]);
+    vecSet(yAxis,  transform[3], transform[4],  transform[5]);
+    vecSet(zAxis,  transform[6], transform[7],  transform[8]);
+    vecSet(center, transform[9], transform[10], transform[11]);
+
+    switch (shape)
+    {
+    case ShapeSphere :
+    case ShapeBox    :
+        // From -1 to 1 on every axis.
+        break;
+    case ShapeCircle :
+        // Flat on the XY plane.
+        vecSet(zAxis, 0.0f, 0.0f, 0.0f);
+        break;
+    default :
+        // From 0 to 1 along Z: cones, capsule parts and arrowheads.
+        vecScale(zAxis, zAxis, 0.5f);
+        vecAdd(center, center, zAxis);
+        break;
+    } // switch (shape)
+
+    return isBoxCulled(DD_EXPLICIT_CONTEXT_ONLY(ctx,) center, xAxis, yAxis, zAxis);
+}
+
+// ========================================================
+// Misc local functions for draw queue management:
+// ========================================================
+
+#ifndef DEBUG_DRAW_QUANTIZED_POSITIONS
+
+static void runVertexExpansionJob(void * userData, const int index)
+{
+    const VertexExpansionJob & job = static_cast<const VertexExpansionJob *>(userData)[index];
+    if (job.type == PrimitivePoints)
+    {
+        const DebugPointArrays & points = *static_cast<const DebugPointArrays *>(job.elements);
+        expandPointVerts(&points.positions[job.first], &points.colors[job.first], &points.sizes[job.first], job.count, job.dest);
+    }
+    else
+    {
+        const DebugLineArrays & lines = *static_cast<const DebugLineArrays *>(job.elements);
+        expandLineVerts(&lines.positions[job.first], &lines.colors[job.first], job.count, job.dest);
+    }
+}
+
+// Expands all the runs recorded for the current batch, in parallel, before it is drawn.
+static void runVertexExpansionJobs(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx))
+{
+    if (DD_CONTEXT->numExpansionJobs == 1)
+    {
+        runVertexExpansionJob(DD_CONTEXT->expansionJobs, 0);
+    }
+    else if (DD_CONTEXT->numExpansionJobs > 1)
+    {
+        DD_CONTEXT->taskScheduler->parallelFor(DD_CONTEXT->numExpansionJobs, runVertexExpansionJob, DD_CONTEXT->expansionJobs);
+    }
+    DD_CONTEXT->numExpansionJobs = 0;
+}
+
+// Expands a run of points or lines into the current batch right away,
+// or records it to be expanded in parallel when the batch is flushed.
+static void expandVertexRun(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const PrimitiveType type,
+                            const void * elements, const int first, const int count)
+{
+    VertexExpansionJob job;
+    job.type     = type;
+    job.elements = elements;
+    job.first    = first;
+    job.count    = count;
+    job.dest     = DD_CONTEXT->vertexBuffer + DD_CONTEXT->vertexBufferUsed;
+
+    if (DD_CONTEXT->taskScheduler == nullptr)
+    {
+        runVertexExpansionJob(&job, 0);
+        return;
+    }
+
+    if (DD_CONTEXT->numExpansionJobs == MaxVertexExpansionJobs)
+    {
+        runVertexExpansionJobs(DD_EXPLICIT_CONTEXT_ONLY(ctx));
+    }
+    DD_CONTEXT->expansionJobs[DD_CONTEXT->numExpansionJobs++] = job;
+}
+
+#endif // DEBUG_DRAW_QUANTIZED_POSITIONS
+
+static void drawVertexBatch(RenderInterface * renderer, const VertexBatch & batch, const void * verts)
+{
+    const DrawVertex    * drawVerts    = static_cast<const DrawVertex *>(verts);
+    const CompactVertex * compactVerts = static_cast<const CompactVertex *>(verts);
+    const bool compact = (batch.format == VertexFormatCompact);
+
+    if (batch.indexCount != 0)
+    {
+        if (batch.type == PrimitiveGlyphs)
+        {
+            renderer->drawIndexedGlyphList(drawVerts, batch.count, batch.indexes, batch.indexCount, batch.glyphTex);
+        }
+        else if (compact)
+        {
+            renderer->drawPackedIndexedLineList(compactVerts, batch.count, batch.indexes, batch.indexCount, batch.depthEnabled);
+        }
+        else
+        {
+            renderer->drawIndexedLineList(drawVerts, batch.count, batch.indexes, batch.indexCount, batch.depthEnabled);
+        }
+        return;
+    }
+
+    switch (batch.type)
+    {
+    case PrimitivePoints :
+        if (compact)
+        {
+            renderer->drawPackedPointList(compactVerts, batch.count, batch.pointSize, batch.depthEnabled);
+        }
+        else
+        {
+            renderer->drawPointList(drawVerts, batch.count, batch.depthEnabled);
+        }
+        break;
+    case PrimitiveLines :
+        if (compact)
+        {
+            renderer->drawPackedLineList(compactVerts, batch.count, batch.depthEnabled);
+        }
+        else
+        {
+            renderer->drawLineList(drawVerts, batch.count, batch.depthEnabled);
+        }
+        break;
+    case PrimitiveGlyphs :
+        renderer->drawGlyphList(drawVerts, batch.count, batch.glyphTex);
+        break;
+    } // switch (batch.type)
+}
+
+static void flushDebugVerts(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const PrimitiveType type, const bool depthEnabled)
+{
+    if (DD_CONTEXT->vertexBufferUsed == 0)
+    {
+        return;
+    }
+
+    #ifndef DEBUG_DRAW_QUANTIZED_POSITIONS
+    runVertexExpansionJobs(DD_EXPLICIT_CONTEXT_ONLY(ctx));
+    #endif // DEBUG_DRAW_QUANTIZED_POSITIONS
+
+    const bool compact = (DD_CONTEXT->vertexFormat == VertexFormatCompact);
+
+    VertexBatch batch;
+    batch.type         = type;
+    batch.format       = (compact && type != PrimitiveGlyphs) ? VertexFormatCompact : VertexFormatDefault;
+    batch.count        = DD_CONTEXT->vertexBufferUsed;
+    batch.depthEnabled = (type != PrimitiveGlyphs) ? depthEnabled : false;
+    batch.pointSize    = (compact && type == PrimitivePoints) ? DD_CONTEXT->packedPointSize : 0.0f;
+    batch.glyphTex     = (type == PrimitiveGlyphs) ? DD_CONTEXT->glyphTexHandle : nullptr;
+    batch.indexes      = (DD_CONTEXT->indexBufferUsed != 0) ? DD_CONTEXT->indexBuffer : nullptr;
+    batch.indexCount   = DD_CONTEXT->indexBufferUsed;
+
+    if (DD_CONTEXT->vertexBatchAcquired)
+    {
+        DD_CONTEXT->renderInterface->commitVertices(batch);
+        DD_CONTEXT->vertexBatchAcquired = false;
+    }
+    else
+    {
+        drawVertexBatch(DD_CONTEXT->renderInterface, batch, DD_CONTEXT->vertexBuffer);
+    }
+
+    DD_CONTEXT->vertexBufferUsed = 0;
+    DD_CONTEXT->indexBufferUsed  = 0;
+}
+
+// Called before writing the first vertex of a batch. Points vertexBuffer to memory
+// from the renderer if it provides some, or to the context's own buffer otherwise.
+static void beginVertexBatch(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const PrimitiveType type)
+{
+    void * verts = DD_CONTEXT->renderInterface->acquireVertices(type, DD_CONTEXT->vertexBufferSize);
+    DD_CONTEXT->vertexBatchAcquired = (verts != nullptr);
+
+    if (verts == nullptr)
+    {
+        verts = DD_CONTEXT->localVertexBuffer;
+    }
+    DD_CONTEXT->vertexBuffer        = static_cast<DrawVertex *>(verts);
+    DD_CONTEXT->compactVertexBuffer = static_cast<CompactVertex *>(verts);
+
+    // Vertexes from the previous batch can't be referenced anymore.
+    if (type == PrimitiveLines && DD_CONTEXT->indexFormat != IndexFormatNone)
+    {
+        for (int i = 0; i < VertexCacheSize; ++i)
+        {
+            DD_CONTEXT->vertexCache[i].index = -1;
+        }
+    }
+}
+
+static inline std::size_t getIndexBufferBytes(const IndexFormat format, const int count)
+{
+    switch (format)
+    {
+    case IndexFormat16 : return sizeof(std::uint16_t) * count;
+    case IndexFormat32 : return sizeof(std::uint32_t) * count;
+    default            : return 0;
+    } // switch (format)
+}
+
+static inline std::size_t getShapeBatchBytes(const bool instancedShapes)
+{
+    return instancedShapes ? sizeof(ShapeInstance) * ShapeBatchSize * ShapeCount : 0;
+}
+
+// Tells if the current batch lacks room for 'numVerts' more vertexes, or for 'numIndexes' more indexes if indexed.
+static inline bool isBatchFull(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const int numVerts, const int numIndexes)
+{
+    return (DD_CONTEXT->vertexBufferUsed + numVerts) >= DD_CONTEXT->vertexBufferSize ||
+           (DD_CONTEXT->indexFormat != IndexFormatNone && (DD_CONTEXT->indexBufferUsed + numIndexes) > DD_CONTEXT->indexBufferSize);
+}
+
+static inline void pushIndex(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const int vertexIndex)
+{
+    if (DD_CONTEXT->indexFormat == IndexFormat16)
+    {
+        static_cast<std::uint16_t *>(DD_CONTEXT->indexBuffer)[DD_CONTEXT->indexBufferUsed++] = static_cast<std::uint16_t>(vertexIndex);
+    }
+    else
+    {
+        static_cast<std::uint32_t *>(DD_CONTEXT->indexBuffer)[DD_CONTEXT->indexBufferUsed++] = static_cast<std::uint32_t>(vertexIndex);
+    }
+}
+
+static inline std::uint32_t hashLineVertex(const float position[3], const std::uint32_t color)
+{
+    union
+    {
+        float         asFloat[3];
+        std::uint32_t asUInt[3];
+    } bits;
+    bits.asFloat[0] = position[0];
+    bits.asFloat[1] = position[1];
+    bits.asFloat[2] = position[2];
+
+    // FNV-1a over the four words. Round coordinates have all their low bits clear,
+    // so the result is mixed with the MurmurHash3 finalizer to spread the high bits
+    // into the low ones used to index the cache.
+    std::uint32_t hash = 2166136261u;
+    hash = (hash ^ bits.asUInt[0]) * 16777619u;
+    hash = (hash ^ bits.asUInt[1]) * 16777619u;
+    hash = (hash ^ bits.asUInt[2]) * 16777619u;
+    hash = (hash ^ color) * 16777619u;
+    hash ^= hash >> 16;
+    hash *= 0x85EBCA6Bu;
+    hash ^= hash >> 13;
+    hash *= 0xC2B2AE35u;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+// Returns the index of a line vertex in the current batch,
+// writing the vertex first if it is not already there.
+static int pushIndexedLineVertex(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const float position[3], const std::uint32_t color)
+{
+    VertexCacheEntry & entry = DD_CONTEXT->vertexCache[hashLineVertex(position, color) & (VertexCacheSize - 1)];
+    if (entry.index >= 0 && entry.color == color &&
+        entry.x == position[X] && entry.y == position[Y] && entry.z == position[Z])
+    {
+        return entry.index;
+    }
+
+    const int index = DD_CONTEXT->vertexBufferUsed++;
+    if (DD_CONTEXT->vertexFormat == VertexFormatCompact)
+    {
+        CompactVertex & v = DD_CONTEXT->compactVertexBuffer[index];
+        v.x     = position[X];
+        v.y     = position[Y];
+        v.z     = position[Z];
+        v.color = color;
+    }
+    else
+    {
+        DrawVertex & v = DD_CONTEXT->vertexBuffer[index];
+        v.line.x = position[X];
+        v.line.y = position[Y];
+        v.line.z = position[Z];
+        v.line.r = unpackColorChannel(color, 0);
+        v.line.g = unpackColorChannel(color, 8);
+        v.line.b = unpackColorChannel(color, 16);
+    }
+
+    entry.x     = position[X];
+    entry.y     = position[Y];
+    entry.z     = position[Z];
+    entry.color = color;
+    entry.index = index;
+    return index;
+}
+
+static void pushPointVert(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const DebugPointArrays & points,
+                          const int index, const bool depthEnabled)
+{
+    if (!isElementSlot(points, index))
+    {
+        return;
+    }
+
+    const float size = points.sizes[index];
+    const bool compact = (DD_CONTEXT->vertexFormat == VertexFormatCompact);
+
+    // Make room for one more vert. Packed batches also have
+    // to be broken whenever the point size changes.
+    if ((DD_CONTEXT->vertexBufferUsed + 1) >= DD_CONTEXT->vertexBufferSize ||
+        (compact && size != DD_CONTEXT->packedPointSize))
+    {
+        flushDebugVerts(DD_EXPLICIT_CONTEXT_ONLY(ctx,) PrimitivePoints, depthEnabled);
+    }
+    if (DD_CONTEXT->vertexBufferUsed == 0)
+    {
+        beginVertexBatch(DD_EXPLICIT_CONTEXT_ONLY(ctx,) PrimitivePoints);
+    }
+
+    float position[3];
+    loadPositions(points, index, position, 1);
+    const std::uint32_t color = points.colors[index];
+
+    if (compact)
+    {
+        CompactVertex & v = DD_CONTEXT->compactVertexBuffer[DD_CONTEXT->vertexBufferUsed++];
+        v.x     = position[X];
+        v.y     = position[Y];
+        v.z     = position[Z];
+        v.color = color;
+        DD_CONTEXT->packedPointSize = size;
+    }
+    else
+    {
+        DrawVertex & v = DD_CONTEXT->vertexBuffer[DD_CONTEXT->vertexBufferUsed++];
+        v.point.x      = position[X];
+        v.point.y      = position[Y];
+        v.point.z      = position[Z];
+        v.point.r      = unpackColorChannel(color, 0);
+        v.point.g      = unpackColorChannel(color, 8);
+        v.point.b      = unpackColorChannel(color, 16);
+        v.point.size   = size;
+    }
+}
+
+static void pushLineVerts(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const float position[6],
+                          const std::uint32_t color, const bool depthEnabled)
+{
+    // Make room for two more verts:
+    if (isBatchFull(DD_EXPLICIT_CONTEXT_ONLY(ctx,) 2, 2))
+    {
+        flushDebugVerts(DD_EXPLICIT_CONTEXT_ONLY(ctx,) PrimitiveLines, depthEnabled);
+    }
+    if (DD_CONTEXT->vertexBufferUsed == 0)
+    {
+        beginVertexBatch(DD_EXPLICIT_CONTEXT_ONLY(ctx,) PrimitiveLines);
+    }
+
+    if (DD_CONTEXT->indexFormat != IndexFormatNone)
+    {
+        const int i0 = pushIndexedLineVertex(DD_EXPLICIT_CONTEXT_ONLY(ctx,) &position[0], color);
+        const int i1 = pushIndexedLineVertex(DD_EXPLICIT_CONTEXT_ONLY(ctx,) &position[3], color);
+        pushIndex(DD_EXPLICIT_CONTEXT_ONLY(ctx,) i0);
+        pushIndex(DD_EXPLICIT_CONTEXT_ONLY(ctx,) i1);
+        return;
+    }
+
+    if (DD_CONTEXT->vertexFormat == VertexFormatCompact)
+    {
+        CompactVertex & v0 = DD_CONTEXT->compactVertexBuffer[DD_CONTEXT->vertexBufferUsed++];
+        CompactVertex & v1 = DD_CONTEXT->compactVertexBuffer[DD_CONTEXT->vertexBufferUsed++];
+
+        v0.x     = position[0];
+        v0.y     = position[1];
+        v0.z     = position[2];
+        v0.color = color;
+
+        v1.x     = position[3];
+        v1.y     = position[4];
+        v1.z     = position[5];
+        v1.color = color;
+    }
+    else
+    {
+        const float r = unpackColorChannel(color, 0);
+        const float g = unpackColorChannel(color, 8);
+        const float b = unpackColorChannel(color, 16);
+
+        DrawVertex & v0 = DD_CONTEXT->vertexBuffer[DD_CONTEXT->vertexBufferUsed++];
+        DrawVertex & v1 = DD_CONTEXT->vertexBuffer[DD_CONTEXT->vertexBufferUsed++];
+
+        v0.line.x = position[0];
+        v0.line.y = position[1];
+        v0.line.z = position[2];
+        v0.line.r = r;
+        v0.line.g = g;
+        v0.line.b = b;
+
+        v1.line.x = position[3];
+        v1.line.y = position[4];
+        v1.line.z = position[5];
+        v1.line.r = r;
+        v1.line.g = g;
+        v1.line.b = b;
+    }
+}
+
+static void pushLineVert(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const DebugLineArrays & lines,
+                         const int index, const bool depthEnabled)
+{
+    if (!isElementSlot(lines, index))
+    {
+        return;
+    }
+
+    float position[6];
+    loadPositions(lines, index, position, 2);
+    pushLineVerts(DD_EXPLICIT_CONTEXT_ONLY(ctx,) position, lines.colors[index], depthEnabled);
+}
+
+// Sends the lines of a queued shape straight to the current line batch.
+struct BatchLineSink
+{
+    DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx;)
+    std::uint32_t color;
+    bool          depthEnabled;
+
+    void operator()(ddVec3_In from, ddVec3_In to) const
+    {
+        const float position[6] = { from[X], from[Y], from[Z], to[X], to[Y], to[Z] };
+        pushLineVerts(DD_EXPLICIT_CONTEXT_ONLY(ctx,) position, color, depthEnabled);
+    }
+};
+
+static void pushGlyphVerts(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const DrawVertex verts[4])
+{
+    static const int indexes[6] = { 0, 1, 2, 2, 1, 3 };
+
+    // Make room for one more glyph (2 tris):
+    if (isBatchFull(DD_EXPLICIT_CONTEXT_ONLY(ctx,) 6, 6))
+    {
+        flushDebugVerts(DD_EXPLICIT_CONTEXT_ONLY(ctx,) PrimitiveGlyphs, false);
+    }
+    if (DD_CONTEXT->vertexBufferUsed == 0)
+    {
+        beginVertexBatch(DD_EXPLICIT_CONTEXT_ONLY(ctx,) PrimitiveGlyphs);
+    }
+
+    // Indexed glyphs only need the 4 corners of the quad.
+    if (DD_CONTEXT->indexFormat != IndexFormatNone)
+    {
+        const int base = DD_CONTEXT->vertexBufferUsed;
+        for (int i = 0; i < 4; ++i)
+        {
+            DD_CONTEXT->vertexBuffer[DD_CONTEXT->vertexBufferUsed++].glyph = verts[i].glyph;
+        }
+        for (int i = 0; i < 6; ++i)
+        {
+            pushIndex(DD_EXPLICIT_CONTEXT_ONLY(ctx,) base + indexes[i]);
+        }
+        return;
+    }
+
+    for (int i = 0; i < 6; ++i)
+    {
+        DD_CONTEXT->vertexBuffer[DD_CONTEXT->vertexBufferUsed++].glyph = verts[indexes[i]].glyph;
+    }
+}
+
+static void pushStringGlyphs(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) float x, float y,
+                             const char * text, ddVec3_In color, const float scaling)
+{
+    // Invariants for all characters:
+    const float initialX    = x;
+    const float scaleU      = static_cast<float>(getFontCharSet().bitmapWidth);
+    const float scaleV      = static_cast<float>(getFontCharSet().bitmapHeight);
+    const float fixedWidth  = static_cast<float>(getFontCharSet().charWidth);
+    const float fixedHeight = static_cast<float>(getFontCharSet().charHeight);
+    const float tabW        = fixedWidth  * 4.0f * scaling; // TAB = 4 spaces.
+    const float chrW        = fixedWidth  * scaling;
+    const float chrH        = fixedHeight * scaling;
+
+    for (; *text != '\0'; ++text)
+    {
+        const int charVal = *text;
+        if (charVal >= FontCharSet::MaxChars)
+        {
+            continue;
+        }
+        if (charVal == ' ')
+        {
+            x += chrW;
+            continue;
+        }
+        if (charVal == '\t')
+        {
+            x += tabW;
+            continue;
+        }
+        if (charVal == '\n')
+        {
+            y += chrH;
+            x  = initialX;
+            continue;
+        }
+
+        const FontChar fontChar = getFontCharSet().chars[charVal];
+        const float u0 = (fontChar.x + 0.5f) / scaleU;
+        const float v0 = (fontChar.y + 0.5f) / scaleV;
+        const float u1 = u0 + (fixedWidth  / scaleU);
+        const float v1 = v0 + (fixedHeight / scaleV);
+
+        DrawVertex verts[4];
+        verts[0].glyph.x = x;
+        verts[0].glyph.y = y;
+        verts[0].glyph.u = u0;
+        verts[0].glyph.v = v0;
+        verts[0].glyph.r = color[X];
+        verts[0].glyph.g = color[Y];
+        verts[0].glyph.b = color[Z];
+        verts[1].glyph.x = x;
+        verts[1].glyph.y = y + chrH;
+        verts[1].glyph.u = u0;
+        verts[1].glyph.v = v1;
+        verts[1].glyph.r = color[X];
+        verts[1].glyph.g = color[Y];
+        verts[1].glyph.b = color[Z];
+        verts[2].glyph.x = x + chrW;
+        verts[2].glyph.y = y;
+        verts[2].glyph.u = u1;
+        verts[2].glyph.v = v0;
+        verts[2].glyph.r = color[X];
+        verts[2].glyph.g = color[Y];
+        verts[2].glyph.b = color[Z];
+        verts[3].glyph.x = x + chrW;
+        verts[3].glyph.y = y + chrH;
+        verts[3].glyph.u = u1;
+        verts[3].glyph.v = v1;
+        verts[3].glyph.r = color[X];
+        verts[3].glyph.g = color[Y];
+        verts[3].glyph.b = color[Z];
+
+        pushGlyphVerts(DD_EXPLICIT_CONTEXT_ONLY(ctx,) verts);
+        x += chrW;
+    }
+}
+
+static float calcTextWidth(const char * text, const float scaling)
+{
+    const float fixedWidth = static_cast<float>(getFontCharSet().charWidth);
+    const float tabW = fixedWidth * 4.0f * scaling; // TAB = 4 spaces.
+    const float chrW = fixedWidth * scaling;
+
+    float x = 0.0f;
+    for (; *text != '\0'; ++text)
+    {
+        // Tabs are handled differently (4 spaces)
+        if (*text == '\t')
+        {
+            x += tabW;
+        }
+        else // Non-tab char (including whitespace)
+        {
+            x += chrW;
+        }
+    }
+
+    return x;
+}
+
+template<typename ChunkType>
+static void pushStringChunkGlyphs(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const ChunkType * chunk)
+{
+    for (; chunk != nullptr; chunk = chunk->next)
+    {
+        for (int i = 0; i < chunk->count; ++i)
+        {
+            const DebugString & dstr = chunk->elements.strings[i];
+            const char * text = DD_CONTEXT->textArena + dstr.textOffset;
+            if (dstr.centered)
+            {
+                // 3D Labels are centered at the point of origin, e.g. center-aligned.
+                const float offset = calcTextWidth(text, dstr.scaling) * 0.5f;
+                pushStringGlyphs(DD_EXPLICIT_CONTEXT_ONLY(ctx,) dstr.posX - offset, dstr.posY, text, dstr.color, dstr.scaling);
+            }
+            else
+            {
+                // Left-aligned
+                pushStringGlyphs(DD_EXPLICIT_CONTEXT_ONLY(ctx,) dstr.posX, dstr.posY, text, dstr.color, dstr.scaling);
+            }
+        }
+    }
+}
+
+#ifndef DEBUG_DRAW_QUANTIZED_POSITIONS
+
+// Makes room for at least one more element of 'vertsPerElement' verts and returns how many of
+// the next 'count' elements fit in the current batch, keeping the same spare slot as the
+// one at a time push functions do. Batches are therefore broken at the same elements.
+static int beginVertexRun(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const PrimitiveType type, const bool depthEnabled,
+                          const int vertsPerElement, const int count)
+{
+    if (isBatchFull(DD_EXPLICIT_CONTEXT_ONLY(ctx,) vertsPerElement, vertsPerElement))
+    {
+        flushDebugVerts(DD_EXPLICIT_CONTEXT_ONLY(ctx,) type, depthEnabled);
+    }
+    if (DD_CONTEXT->vertexBufferUsed == 0)
+    {
+        beginVertexBatch(DD_EXPLICIT_CONTEXT_ONLY(ctx,) type);
+    }
+
+    const int room = (DD_CONTEXT->vertexBufferSize - DD_CONTEXT->vertexBufferUsed - 1) / vertsPerElement;
+    return (room < count) ? room : count;
+}
+
+// Expands the points [first, end) of a chunk in runs as large as the vertex buffer allows.
+// Only for dd::DrawVertex batches, packed points are batched by size instead.
+static void pushPointVertRuns(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const DebugPointArrays & points,
+                              int first, const int end, const bool depthEnabled)
+{
+    while (first < end)
+    {
+        const int runLength = beginVertexRun(DD_EXPLICIT_CONTEXT_ONLY(ctx,) PrimitivePoints, depthEnabled, 1, end - first);
+        expandVertexRun(DD_EXPLICIT_CONTEXT_ONLY(ctx,) PrimitivePoints, &points, first, runLength);
+
+        DD_CONTEXT->vertexBufferUsed += runLength;
+        first += runLength;
+    }
+}
+
+// Same as above, for non-indexed dd::DrawVertex line batches.
+static void pushLineVertRuns(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const DebugLineArrays & lines,
+                             int first, const int end, const bool depthEnabled)
+{
+    while (first < end)
+    {
+        const int runLength = beginVertexRun(DD_EXPLICIT_CONTEXT_ONLY(ctx,) PrimitiveLines, depthEnabled, 2, end - first);
+        expandVertexRun(DD_EXPLICIT_CONTEXT_ONLY(ctx,) PrimitiveLines, &lines, first, runLength);
+
+        DD_CONTEXT->vertexBufferUsed += runLength * 2;
+        first += runLength;
+    }
+}
+
+#endif // DEBUG_DRAW_QUANTIZED_POSITIONS
+
+// Pushes the points [first, end) of a chunk, in runs if the vertex format allows it.
+static void pushElementRange(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const DebugPointArrays & points,
+                             const int first, const int end, const bool depthEnabled)
+{
+    #ifndef DEBUG_DRAW_QUANTIZED_POSITIONS
+    if (DD_CONTEXT->vertexFormat == VertexFormatDefault)
+    {
+        pushPointVertRuns(DD_EXPLICIT_CONTEXT_ONLY(ctx,) points, first, end, depthEnabled);
+    }
+    else
+    #endif // DEBUG_DRAW_QUANTIZED_POSITIONS
+    {
+        for (int i = first; i < end; ++i)
+        {
+            pushPointVert(DD_EXPLICIT_CONTEXT_ONLY(ctx,) points, i, depthEnabled);
+        }
+    }
+}
+
+// Same as above, for lines.
+static void pushElementRange(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const DebugLineArrays & lines,
+                             const int first, const int end, const bool depthEnabled)
+{
+    #ifndef DEBUG_DRAW_QUANTIZED_POSITIONS
+    if (DD_CONTEXT->vertexFormat == VertexFormatDefault && DD_CONTEXT->indexFormat == IndexFormatNone)
+    {
+        pushLineVertRuns(DD_EXPLICIT_CONTEXT_ONLY(ctx,) lines, first, end, depthEnabled);
+    }
+    else
+    #endif // DEBUG_DRAW_QUANTIZED_POSITIONS
+    {
+        for (int i = first; i < end; ++i)
+        {
+            pushLineVert(DD_EXPLICIT_CONTEXT_ONLY(ctx,) lines, i, depthEnabled);
+        }
+    }
+}
+
+// Sets culled[i] for the elements [first, end) of a chunk that are outside the culling planes.
+template<typename ArraysType>
+static void cullElements(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const ArraysType & elements,
+                         const int first, const int end, std::uint8_t * culled)
+{
+    const int numCoords = arrayLength(elements.positions[0]); // 3 for points, 6 for lines.
+    #ifdef DEBUG_DRAW_QUANTIZED_POSITIONS
+    for (int i = first; i < end; ++i)
+    {
+        if (!isElementSlot(elements, i))
+        {
+            culled[i] = 1;
+            continue;
+        }
+        float position[6];
+        loadPositions(elements, i, position, numCoords / 3);
+        cullSegments(DD_CONTEXT->cullPlaneLanes, position, numCoords, numCoords - 3, 1, culled + i);
+    }
+    #else // !DEBUG_DRAW_QUANTIZED_POSITIONS
+    cullSegments(DD_CONTEXT->cullPlaneLanes, elements.positions[first], numCoords, numCoords - 3, end - first, culled + first);
+    #endif // DEBUG_DRAW_QUANTIZED_POSITIONS
+}
+
+// Pushes the elements [first, end) of a chunk that are not culled, in runs of consecutive ones.
+template<typename ArraysType>
+static void pushVisibleElementRange(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const ArraysType & elements,
+                                    int first, const int end, const bool depthEnabled)
+{
+    std::uint8_t culled[DEBUG_DRAW_QUEUE_CHUNK_SIZE];
+    cullElements(DD_EXPLICIT_CONTEXT_ONLY(ctx,) elements, first, end, culled);
+
+    while (first < end)
+    {
+        while (first < end && culled[first])
+        {
+            ++first;
+        }
+        int runEnd = first;
+        while (runEnd < end && !culled[runEnd])
+        {
+            ++runEnd;
+        }
+        if (first < runEnd)
+        {
+            pushElementRange(DD_EXPLICIT_CONTEXT_ONLY(ctx,) elements, first, runEnd, depthEnabled);
+        }
+        first = runEnd;
+    }
+}
+
+static inline std::int64_t getFlushClockMicros()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Checked after each queue chunk a time budgeted dd::flush() draws, so
+// every call draws at least one chunk, however small the budget is.
+static void updateFlushOutOfTime(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx))
+{
+    if (DD_CONTEXT->flushDeadlineMicros != 0 && getFlushClockMicros() >= DD_CONTEXT->flushDeadlineMicros)
+    {
+        DD_CONTEXT->flushOutOfTime = true;
+    }
+}
+
+// Pushes the verts of 'count' points of a chunk list, starting 'skip' points in.
+// All share the same 'depthEnabled' state. If 'timeLimited', stops at a chunk
+// boundary once the flush runs out of time. If 'culling', skips the points outside
+// the culling planes. Returns the number of points pushed or skipped.
+template<typename ChunkType>
+static int pushPointChunkVerts(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const ChunkType * chunk, int skip, const int count,
+                               const bool depthEnabled, const bool timeLimited, const bool culling)
+{
+    int pushed = 0;
+    for (; chunk != nullptr && pushed < count; chunk = chunk->next)
+    {
+        if (skip >= chunk->numElements)
+        {
+            skip -= chunk->numElements;
+            continue;
+        }
+        if (timeLimited && DD_CONTEXT->flushOutOfTime)
+        {
+            break;
+        }
+
+        const int numElements = (chunk->numElements - skip < count - pushed) ? chunk->numElements - skip : count - pushed;
+        const int first = getElementsEndSlot(chunk->elements, 0, skip);
+        const int end   = getElementsEndSlot(chunk->elements, first, numElements);
+        pushed += numElements;
+        skip = 0;
+
+        if (culling)
+        {
+            pushVisibleElementRange(DD_EXPLICIT_CONTEXT_ONLY(ctx,) chunk->elements, first, end, depthEnabled);
+        }
+        else
+        {
+            pushElementRange(DD_EXPLICIT_CONTEXT_ONLY(ctx,) chunk->elements, first, end, depthEnabled);
+        }
+
+        if (timeLimited)
+        {
+            updateFlushOutOfTime(DD_EXPLICIT_CONTEXT_ONLY(ctx));
+        }
+    }
+    return pushed;
+}
+
+// Same as above, for lines.
+template<typename ChunkType>
+static int pushLineChunkVerts(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const ChunkType * chunk, int skip, const int count,
+                              const bool depthEnabled, const bool timeLimited, const bool culling)
+{
+    int pushed = 0;
+    for (; chunk != nullptr && pushed < count; chunk = chunk->next)
+    {
+        if (skip >= chunk->numElements)
+        {
+            skip -= chunk->numElements;
+            continue;
+        }
+        if (timeLimited && DD_CONTEXT->flushOutOfTime)
+        {
+            break;
+        }
+
+        const int numElements = (chunk->numElements - skip < count - pushed) ? chunk->numElements - skip : count - pushed;
+        const int first = getElementsEndSlot(chunk->elements, 0, skip);
+        const int end   = getElementsEndSlot(chunk->elements, first, numElements);
+        pushed += numElements;
+        skip = 0;
+
+        if (culling)
+        {
+            pushVisibleElementRange(DD_EXPLICIT_CONTEXT_ONLY(ctx,) chunk->elements, first, end, depthEnabled);
+        }
+        else
+        {
+            pushElementRange(DD_EXPLICIT_CONTEXT_ONLY(ctx,) chunk->elements, first, end, depthEnabled);
+        }
+
+        if (timeLimited)
+        {
+            updateFlushOutOfTime(DD_EXPLICIT_CONTEXT_ONLY(ctx));
+        }
+    }
+    return pushed;
+}
+
+// Expands up to 'count' shapes of a chunk list into the current line batch, starting 'skip'
+// shapes in, for as long as their lines fit in 'maxLines'. If 'drawFirst', the first shape
+// is drawn even if it alone doesn't fit, so a small budget can't block the queue forever.
+// If 'timeLimited', stops once the flush runs out of time, checked after every shape since
+// each one expands into hundreds of lines. If 'culling', skips the shapes outside the culling
+// planes before generating any of their lines. Returns the number of shapes drawn or skipped,
+// setting 'outLines' to the lines they took.
+template<typename ChunkType>
+static int pushShapeChunkLines(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const ChunkType * chunk, int skip, const int count,
+                               const int maxLines, const bool drawFirst, const bool depthEnabled, const bool timeLimited,
+                               const bool culling, int & outLines)
+{
+    BatchLineSink sink;
+    DD_EXPLICIT_CONTEXT_ONLY(sink.ctx = ctx;)
+    sink.depthEnabled = depthEnabled;
+
+    const float pixelScaleSq = DD_CONTEXT->lodPixelScaleSq;
+    int drawn = 0;
+    outLines  = 0;
+
+    for (; chunk != nullptr && drawn < count; chunk = chunk->next)
+    {
+        if (skip >= chunk->count)
+        {
+            skip -= chunk->count;
+            continue;
+        }
+        const DebugShapeArrays & shapes = chunk->elements;
+        for (int i = skip; i < chunk->count && drawn < count; ++i)
+        {
+            if (timeLimited && DD_CONTEXT->flushOutOfTime)
+            {
+                return drawn;
+            }
+
+            // A culled shape takes a single line, as a culled line would.
+            const float * transform = shapes.instances[i].transform;
+            const bool culled  = culling && isShapeCulled(DD_EXPLICIT_CONTEXT_ONLY(ctx,) shapes.shapeIds[i], transform);
+            const int lodSteps = (!culled && pixelScaleSq > 0.0f) ? getShapeLodSteps(transform, DD_CONTEXT->viewProjMatrix, pixelScaleSq) : 0;
+
+            const int numLines = culled ? 1 : getShapeLineCount(shapes.shapeIds[i], lodSteps);
+            if (outLines + numLines > maxLines && !(drawFirst && drawn == 0))
+            {
+                return drawn;
+            }
+
+            if (!culled)
+            {
+                sink.color = shapes.instances[i].color;
+                shapeLines(sink, shapes.shapeIds[i], transform, lodSteps);
+            }
+            outLines += numLines;
+            ++drawn;
+
+            if (timeLimited)
+            {
+                updateFlushOutOfTime(DD_EXPLICIT_CONTEXT_ONLY(ctx));
+            }
+        }
+        skip = 0;
+    }
+    return drawn;
+}
+
+// Lines the shapes of a chunk list expand into at their fixed steps, or if 'lodBound',
+// the most they can expand into once the screen-space LOD picks their steps.
+template<typename ChunkType>
+static std::int64_t getShapeChunkLineCount(const ChunkType * chunk, const bool lodBound)
+{
+    std::int64_t numLines = 0;
+    for (; chunk != nullptr; chunk = chunk->next)
+    {
+        for (int i = 0; i < chunk->count; ++i)
+        {
+            numLines += getShapeLineCount(chunk->elements.shapeIds[i], lodBound ? MaxShapeSteps : 0);
+        }
+    }
+    return numLines;
+}
+
+// Finds which part of the next 'listCount' timed elements in draw order falls inside the slice.
+// Returns false if none does.
+static bool getTimedSliceRange(FlushSlice & slice, const int listCount, int & outSkip, int & outCount)
+{
+    const int listFirst = slice.timedSeen;
+    slice.timedSeen += listCount;
+
+    const int first = (listFirst > slice.timedFirst) ? listFirst : slice.timedFirst;
+    const int last  = (slice.timedSeen < slice.timedLast) ? slice.timedSeen : slice.timedLast;
+    if (first >= last)
+    {
+        return false;
+    }
+
+    outSkip  = first - listFirst;
+    outCount = last - first;
+    return true;
+}
+
+static void drawDebugStrings(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const int layer)
+{
+    const DebugQueue<DebugStringArray> & queue = DD_CONTEXT->debugStrings;
+    const int partition = getQueuePartition(layer, false);
+    if (queue.partitionCounts[partition] == 0)
+    {
+        return;
+    }
+
+    pushStringChunkGlyphs(DD_EXPLICIT_CONTEXT_ONLY(ctx,) queue.transient[partition].head);
+    for (const DebugQueue<DebugStringArray>::Bucket * bucket = queue.buckets; bucket != nullptr; bucket = bucket->next)
+    {
+        pushStringChunkGlyphs(DD_EXPLICIT_CONTEXT_ONLY(ctx,) bucket->chunks[partition].head);
+    }
+
+    flushDebugVerts(DD_EXPLICIT_CONTEXT_ONLY(ctx,) PrimitiveGlyphs, false);
+}
+
+static void drawDebugPoints(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const int layer)
+{
+    const DebugQueue<DebugPointArrays> & queue = DD_CONTEXT->debugPoints;
+    FlushSlice & slice = DD_CONTEXT->pointSlice;
+
+    // Points with depth test ENABLED first, then the ones with depth DISABLED:
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        const bool depthEnabled = (pass == 0);
+        const int partition = getQueuePartition(layer, depthEnabled);
+        if (queue.partitionCounts[partition] == 0)
+        {
+            continue;
+        }
+
+        const DebugChunkList<DebugQueue<DebugPointArrays>::Chunk> & transient = queue.transient[partition];
+        slice.transientLeft -= pushPointChunkVerts(DD_EXPLICIT_CONTEXT_ONLY(ctx,) transient.head, 0,
+                                                   (transient.count < slice.transientLeft) ? transient.count : slice.transientLeft,
+                                                   depthEnabled, slice.transientTimeLimited, false);
+
+        for (const DebugQueue<DebugPointArrays>::Bucket * bucket = queue.buckets; bucket != nullptr; bucket = bucket->next)
+        {
+            int skip, count;
+            if (getTimedSliceRange(slice, bucket->chunks[partition].count, skip, count))
+            {
+                slice.timedDrawn += pushPointChunkVerts(DD_EXPLICIT_CONTEXT_ONLY(ctx,) bucket->chunks[partition].head,
+                                                        skip, count, depthEnabled, true, DD_CONTEXT->flushCullTimed);
+            }
+        }
+        flushDebugVerts(DD_EXPLICIT_CONTEXT_ONLY(ctx,) PrimitivePoints, depthEnabled);
+    }
+}
+
+// Also expands the queued shapes, unless they are drawn instanced.
+static void drawDebugLines(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const int layer)
+{
+    const DebugQueue<DebugLineArrays> & queue = DD_CONTEXT->debugLines;
+    const DebugQueue<DebugShapeArrays> & shapes = DD_CONTEXT->debugShapes;
+    FlushSlice & slice = DD_CONTEXT->lineSlice;
+
+    // Lines with depth test ENABLED first, then the ones with depth DISABLED:
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        const bool depthEnabled = (pass == 0);
+        const int partition = getQueuePartition(layer, depthEnabled);
+        const bool hasShapes = !DD_CONTEXT->instancedShapes && shapes.partitionCounts[partition] != 0;
+        if (queue.partitionCounts[partition] == 0 && !hasShapes)
+        {
+            continue;
+        }
+
+        const DebugChunkList<DebugQueue<DebugLineArrays>::Chunk> & transient = queue.transient[partition];
+        slice.transientLeft -= pushLineChunkVerts(DD_EXPLICIT_CONTEXT_ONLY(ctx,) transient.head, 0,
+                                                  (transient.count < slice.transientLeft) ? transient.count : slice.transientLeft,
+                                                  depthEnabled, slice.transientTimeLimited, false);
+
+        int skip, count;
+        for (const DebugQueue<DebugLineArrays>::Bucket * bucket = queue.buckets; bucket != nullptr; bucket = bucket->next)
+        {
+            if (getTimedSliceRange(slice, bucket->chunks[partition].count, skip, count))
+            {
+                slice.timedDrawn += pushLineChunkVerts(DD_EXPLICIT_CONTEXT_ONLY(ctx,) bucket->chunks[partition].head,
+                                                       skip, count, depthEnabled, true, DD_CONTEXT->flushCullTimed);
+            }
+        }
+
+        if (hasShapes)
+        {
+            int numLines;
+            const DebugChunkList<DebugQueue<DebugShapeArrays>::Chunk> & transientShapes = shapes.transient[partition];
+            pushShapeChunkLines(DD_EXPLICIT_CONTEXT_ONLY(ctx,) transientShapes.head, 0, transientShapes.count, slice.transientLeft,
+                                false, depthEnabled, slice.transientTimeLimited, false, numLines);
+            slice.transientLeft -= numLines;
+
+            // Timed shapes follow the timed lines in draw order. Each takes a single place in the
+            // slice, but the lines it expands into come off the budget, moving the end of the slice.
+            for (const DebugQueue<DebugShapeArrays>::Bucket * bucket = shapes.buckets; bucket != nullptr; bucket = bucket->next)
+            {
+                const DebugChunkList<DebugQueue<DebugShapeArrays>::TimedChunk> & timedShapes = bucket->chunks[partition];
+                if (getTimedSliceRange(slice, timedShapes.count, skip, count))
+                {
+                    const int first = slice.timedSeen - timedShapes.count + skip;
+                    const int drawn = pushShapeChunkLines(DD_EXPLICIT_CONTEXT_ONLY(ctx,) timedShapes.head, skip, count,
+                                                          slice.timedLast - first, slice.timedDrawn == 0,
+                                                          depthEnabled, true, DD_CONTEXT->flushCullTimed, numLines);
+                    const int last = slice.timedLast - (numLines - drawn);
+                    slice.timedLast   = (drawn < count || last < first + drawn) ? first + drawn : last;
+                    slice.timedDrawn += drawn;
+                }
+            }
+        }
+        flushDebugVerts(DD_EXPLICIT_CONTEXT_ONLY(ctx,) PrimitiveLines, depthEnabled);
+    }
+}
+
+static void flushShapeBatch(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const int shape, const bool depthEnabled)
+{
+    int & count = DD_CONTEXT->shapeBatchCounts[shape];
+    if (count != 0)
+    {
+        DD_CONTEXT->renderInterface->drawInstancedShapes(static_cast<ShapeId>(shape), DD_CONTEXT->shapeBatches + shape * ShapeBatchSize,
+                                                         count, depthEnabled);
+        count = 0;
+    }
+}
+
+// Sorts the instances of a chunk list into the batch of their shape, drawing the full batches.
+// If 'culling', skips the instances outside the culling planes.
+template<typename ChunkType>
+static void pushShapeChunkInstances(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const ChunkType * chunk, const bool depthEnabled,
+                                    const bool culling)
+{
+    for (; chunk != nullptr; chunk = chunk->next)
+    {
+        const DebugShapeArrays & shapes = chunk->elements;
+        for (int i = 0; i < chunk->count; ++i)
+        {
+            const int shape = shapes.shapeIds[i];
+            if (culling && isShapeCulled(DD_EXPLICIT_CONTEXT_ONLY(ctx,) shape, shapes.instances[i].transform))
+            {
+                continue;
+            }
+
+            int & count = DD_CONTEXT->shapeBatchCounts[shape];
+            DD_CONTEXT->shapeBatches[shape * ShapeBatchSize + count] = shapes.instances[i];
+            if (++count == ShapeBatchSize)
+            {
+                flushShapeBatch(DD_EXPLICIT_CONTEXT_ONLY(ctx,) shape, depthEnabled);
+            }
+        }
+    }
+}
+
+// Only used if the shapes are drawn instanced. Otherwise drawDebugLines() expands them.
+static void drawDebugShapes(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const int layer)
+{
+    const DebugQueue<DebugShapeArrays> & queue = DD_CONTEXT->debugShapes;
+
+    // Shapes with depth test ENABLED first, then the ones with depth DISABLED:
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        const bool depthEnabled = (pass == 0);
+        const int partition = getQueuePartition(layer, depthEnabled);
+        if (queue.partitionCounts[partition] == 0)
+        {
+            continue;
+        }
+
+        pushShapeChunkInstances(DD_EXPLICIT_CONTEXT_ONLY(ctx,) queue.transient[partition].head, depthEnabled, false);
+        for (const DebugQueue<DebugShapeArrays>::Bucket * bucket = queue.buckets; bucket != nullptr; bucket = bucket->next)
+        {
+            pushShapeChunkInstances(DD_EXPLICIT_CONTEXT_ONLY(ctx,) bucket->chunks[partition].head, depthEnabled,
+                                    DD_CONTEXT->flushCullTimed);
+        }
+        for (int shape = 0; shape < ShapeCount; ++shape)
+        {
+            flushShapeBatch(DD_EXPLICIT_CONTEXT_ONLY(ctx,) shape, depthEnabled);
+        }
+    }
+}
+
+// Queues an instance of a unit shape mesh. The axes are where the mesh's unit X, Y and Z
+// axes end up in world space, 'origin' is where its origin does (see dd::ShapeInstance).
+static void pushShapeInstance(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const ShapeId shape,
+                              ddVec3_In xAxis, ddVec3_In yAxis, ddVec3_In zAxis, ddVec3_In origin,
+                              ddVec3_In color, const int durationMillis, const bool depthEnabled)
+{
+    int index;
+    DebugShapeArrays * shapes = pushQueueSlot(DD_CONTEXT->debugShapes, getQueuePartition(DD_CONTEXT->renderLayer, depthEnabled),
+                                              DD_CONTEXT->currentTimeMillis, durationMillis, nullptr, 0, index);
+    if (shapes == nullptr)
+    {
+        DEBUG_DRAW_OVERFLOWED("Max debug shapes limit reached! Dropping further instanced shape draws.");
+        return;
+    }
+
+    float * transform = shapes->instances[index].transform;
+    for (int c = 0; c < 3; ++c)
+    {
+        transform[c]     = xAxis[c];
+        transform[c + 3] = yAxis[c];
+        transform[c + 6] = zAxis[c];
+        transform[c + 9] = origin[c];
+    }
+    shapes->instances[index].color = packColor(color);
+    shapes->shapeIds[index] = static_cast<std::uint8_t>(shape);
+}
+
+// Allocates the two text arena buffers, 'sizeBytes' each. Both are left null on failure.
+static bool allocTextArena(Allocator * allocator, char *& arena, char *& arenaBack, const int sizeBytes)
+{
+    arena     = static_cast<char *>(allocMemory(allocator, sizeBytes, 1, AllocTagStrings));
+    arenaBack = static_cast<char *>(allocMemory(allocator, sizeBytes, 1, AllocTagStrings));
+    if (arena == nullptr || arenaBack == nullptr)
+    {
+        freeMemory(allocator, arena,     sizeBytes, AllocTagStrings);
+        freeMemory(allocator, arenaBack, sizeBytes, AllocTagStrings);
+        arena     = nullptr;
+        arenaBack = nullptr;
+        return false;
+    }
+    return true;
+}
+
+static void freeTextArena(Allocator * allocator, char * arena, char * arenaBack, const int sizeBytes)
+{
+    freeMemory(allocator, arena,     sizeBytes, AllocTagStrings);
+    freeMemory(allocator, arenaBack, sizeBytes, AllocTagStrings);
+}
+
+// Reallocates both text arena buffers with 'newSize' bytes, which must not be less than
+// textArenaUsed. Existing strings keep their offsets, so only the used part is copied.
+static bool resizeTextArena(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const int newSize)
+{
+    char * newArena = nullptr;
+    char * newBack  = nullptr;
+    if (newSize > 0 && !allocTextArena(DD_CONTEXT->allocator, newArena, newBack, newSize))
+    {
+        return false;
+    }
+
+    for (int i = 0; i < DD_CONTEXT->textArenaUsed; ++i)
+    {
+        newArena[i] = DD_CONTEXT->textArena[i];
+    }
+
+    freeTextArena(DD_CONTEXT->allocator, DD_CONTEXT->textArena, DD_CONTEXT->textArenaBack, DD_CONTEXT->textArenaSize);
+
+    DD_CONTEXT->textArena     = newArena;
+    DD_CONTEXT->textArenaBack = newBack;
+    DD_CONTEXT->textArenaSize = newSize;
+    return true;
+}
+
+// Makes room for at least 'minSize' bytes in each of the two text arena buffers.
+static bool growTextArena(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const int minSize)
+{
+    int newSize = (DD_CONTEXT->textArenaSize > 0) ? (DD_CONTEXT->textArenaSize * 2) : 64;
+    if (newSize < minSize)
+    {
+        newSize = minSize;
+    }
+    return resizeTextArena(DD_EXPLICIT_CONTEXT_ONLY(ctx,) newSize);
+}
+
+// Copies the text to the arena and queues a new string that refers to it.
+// Returns null if either the strings queue or the text arena are full.
+static DebugString * pushDebugString(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const char * str,
+                                     const int length, const int durationMillis)
+{
+    const int needed = DD_CONTEXT->textArenaUsed + length + 1; // +1 for the null terminator.
+    if (needed > DD_CONTEXT->textArenaSize)
+    {
+        if (!DD_CONTEXT->growableTextArena || !growTextArena(DD_EXPLICIT_CONTEXT_ONLY(ctx,) needed))
+        {
+            DEBUG_DRAW_OVERFLOWED("Debug text arena is full! Dropping further debug string draws.");
+            return nullptr;
+        }
+    }
+
+    int index;
+    DebugStringArray * strings = pushQueueSlot(DD_CONTEXT->debugStrings, getQueuePartition(DD_CONTEXT->renderLayer, false),
+                                               DD_CONTEXT->currentTimeMillis, durationMillis, nullptr, 0, index);
+    if (strings == nullptr)
+    {
+        DEBUG_DRAW_OVERFLOWED("Max debug strings limit reached! Dropping further debug string draws.");
+        return nullptr;
+    }
+
+    char * text = DD_CONTEXT->textArena + DD_CONTEXT->textArenaUsed;
+    for (int i = 0; i < length; ++i)
+    {
+        text[i] = str[i];
+    }
+    text[length] = '\0';
+
+    DebugString * dstr = &strings->strings[index];
+    dstr->textOffset = DD_CONTEXT->textArenaUsed;
+    dstr->textLength = length;
+
+    DD_CONTEXT->textArenaUsed = needed;
+    if (needed > DD_CONTEXT->textArenaHighWater)
+    {
+        DD_CONTEXT->textArenaHighWater = needed;
+    }
+    return dstr;
+}
+
+template<typename ChunkType>
+static void moveStringsText(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) ChunkType * chunk, int & backUsed)
+{
+    for (; chunk != nullptr; chunk = chunk->next)
+    {
+        for (int i = 0; i < chunk->count; ++i)
+        {
+            DebugString & dstr = chunk->elements.strings[i];
+            const char * src = DD_CONTEXT->textArena + dstr.textOffset;
+            char * dst = DD_CONTEXT->textArenaBack + backUsed;
+
+            // Copy including the null terminator.
+            for (int c = 0; c <= dstr.textLength; ++c)
+            {
+                dst[c] = src[c];
+            }
+
+            dstr.textOffset = backUsed;
+            backUsed += dstr.textLength + 1;
+        }
+    }
+}
+
+// Called after the strings queue is cleared. Copies the text of the strings that
+// are still queued to the back buffer and swaps the buffers, so the arena never
+// fills up with the text of expired strings. Cheap when nothing is left queued.
+static void compactTextArena(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx))
+{
+    const DebugQueue<DebugStringArray> & queue = DD_CONTEXT->debugStrings;
+    if (queue.count == 0)
+    {
+        DD_CONTEXT->textArenaUsed = 0;
+        return;
+    }
+
+    int liveBytes = 0;
+    for (const DebugQueue<DebugStringArray>::Bucket * bucket = queue.buckets; bucket != nullptr; bucket = bucket->next)
+    {
+        for (int p = 0; p < NumQueuePartitions; ++p)
+        {
+            for (const DebugQueue<DebugStringArray>::TimedChunk * chunk = bucket->chunks[p].head; chunk != nullptr; chunk = chunk->next)
+            {
+                for (int i = 0; i < chunk->count; ++i)
+                {
+                    liveBytes += chunk->elements.strings[i].textLength + 1;
+                }
+            }
+        }
+    }
+
+    if (liveBytes == DD_CONTEXT->textArenaUsed)
+    {
+        return; // No garbage.
+    }
+
+    // Transient strings are always gone by now, only the buckets hold strings.
+    int backUsed = 0;
+    for (DebugQueue<DebugStringArray>::Bucket * bucket = DD_CONTEXT->debugStrings.buckets; bucket != nullptr; bucket = bucket->next)
+    {
+        for (int p = 0; p < NumQueuePartitions; ++p)
+        {
+            moveStringsText(DD_EXPLICIT_CONTEXT_ONLY(ctx,) bucket->chunks[p].head, backUsed);
+        }
+    }
+
+    char * temp = DD_CONTEXT->textArena;
+    DD_CONTEXT->textArena     = DD_CONTEXT->textArenaBack;
+    DD_CONTEXT->textArenaBack = temp;
+    DD_CONTEXT->textArenaUsed = backUsed;
+}
+
+// Appends a copy of the element at 'srcIndex' of 'src' to the given partition of
+// 'bucket'. Returns false if out of memory, in which case the element is dropped.
+template<typename ArraysType>
+static bool moveTimedElement(DebugQueue<ArraysType> & queue, typename DebugQueue<ArraysType>::Bucket & bucket, const int partition,
+                             const TimedDebugChunk<ArraysType> & src, const int srcIndex)
+{
+    int index;
+    TimedDebugChunk<ArraysType> * chunk = pushBucketSlot(queue, bucket, partition, src.expiryDateMillis[srcIndex],
+                                                         nullptr, 0, index);
+    if (chunk == nullptr)
+    {
+        return false;
+    }
+
+    moveElement(chunk->elements, index, src.elements, srcIndex);
+    return true;
+}
+
+// Same as above, for points and lines. Positions are stored again relative to
+// the new chunk, where they can take a different number of slots if quantized.
+template<typename ArraysType>
+static bool movePositionedTimedElement(DebugQueue<ArraysType> & queue, typename DebugQueue<ArraysType>::Bucket & bucket,
+                                       const int partition, const TimedDebugChunk<ArraysType> & src, const int srcIndex,
+                                       const int numPositions)
+{
+    float positions[6];
+    loadPositions(src.elements, srcIndex, positions, numPositions);
+
+    int index;
+    TimedDebugChunk<ArraysType> * chunk = pushBucketSlot(queue, bucket, partition, src.expiryDateMillis[srcIndex],
+                                                         positions, numPositions, index);
+    if (chunk == nullptr)
+    {
+        return false;
+    }
+
+    moveElement(chunk->elements, index, src.elements, srcIndex);
+    storePositions(chunk->elements, index, positions, numPositions);
+    return true;
+}
+
+static inline bool moveTimedElement(DebugQueue<DebugPointArrays> & queue, DebugQueue<DebugPointArrays>::Bucket & bucket,
+                                    const int partition, const TimedDebugChunk<DebugPointArrays> & src, const int srcIndex)
+{
+    return movePositionedTimedElement(queue, bucket, partition, src, srcIndex, 1);
+}
+
+static inline bool moveTimedElement(DebugQueue<DebugLineArrays> & queue, DebugQueue<DebugLineArrays>::Bucket & bucket,
+                                    const int partition, const TimedDebugChunk<DebugLineArrays> & src, const int srcIndex)
+{
+    return movePositionedTimedElement(queue, bucket, partition, src, srcIndex, 2);
+}
+
+// Called once 'time' reaches the window of the first bucket of the queue, which must not
+// be of level zero. Moves its elements that expire after 'time' to finer buckets, whose
+// windows the time has not reached yet, then returns it and its chunks to the pools.
+template<typename ArraysType>
+static void splitFirstBucket(DebugQueue<ArraysType> & queue, const std::int64_t time)
+{
+    typedef typename DebugQueue<ArraysType>::TimedChunk TimedChunk;
+    typedef typename DebugQueue<ArraysType>::Bucket     Bucket;
+
+    // Unlinked first, so the elements can't go back to it.
+    Bucket * bucket = queue.buckets;
+    queue.buckets = bucket->next;
+    if (queue.lastBucket == bucket)
+    {
+        queue.lastBucket = nullptr;
+    }
+
+    queue.count -= bucket->count;
+    for (int p = 0; p < NumQueuePartitions; ++p)
+    {
+        queue.partitionCounts[p] -= bucket->chunks[p].count;
+        for (const TimedChunk * chunk = bucket->chunks[p].head; chunk != nullptr; chunk = chunk->next)
+        {
+            for (int i = 0; i < chunk->count; ++i)
+            {
+                const std::int64_t expiryDateMillis = chunk->expiryDateMillis[i];
+                if (!isElementSlot(chunk->elements, i) || expiryDateMillis <= time)
+                {
+                    continue;
+                }
+
+                Bucket * finerBucket = findExpiryBucket(queue, expiryDateMillis, time);
+                if (finerBucket != nullptr)
+                {
+                    moveTimedElement(queue, *finerBucket, p, *chunk, i);
+                }
+            }
+        }
+        releaseChunkList(bucket->chunks[p], queue.freeTimedChunks);
+    }
+    bucket->count = 0;
+
+    bucket->next      = queue.freeBuckets;
+    queue.freeBuckets = bucket;
+}
+
+template<typename ArraysType>
+static void clearDebugQueue(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) DebugQueue<ArraysType> & queue)
+{
+    const std::int64_t time = DD_CONTEXT->currentTimeMillis;
+    if (time == 0)
+    {
+        resetQueue(queue);
+        return;
+    }
+
+    // Transient elements were drawn once, so they all go at once.
+    releaseTransient(queue);
+
+    // Buckets cover disjoint windows in ascending order, so only the first few can have been
+    // reached by the time. Those whose elements all expired go whole. A coarser one that still
+    // has elements to draw is split in finer buckets, the finest being kept until its last
+    // element expires.
+    while (queue.buckets != nullptr && queue.buckets->windowStart <= time)
+    {
+        if (queue.buckets->lastExpiryMillis <= time)
+        {
+            releaseFirstBucket(queue);
+        }
+        else if (queue.buckets->level != 0)
+        {
+            splitFirstBucket(queue, time);
+        }
+        else
+        {
+            break;
+        }
+    }
+}
+
+static void setupGlyphTexture(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx))
+{
+    if (DD_CONTEXT->renderInterface == nullptr)
+    {
+        return;
+    }
+
+    if (DD_CONTEXT->glyphTexHandle != nullptr)
+    {
+        DD_CONTEXT->renderInterface->destroyGlyphTexture(DD_CONTEXT->glyphTexHandle);
+        DD_CONTEXT->glyphTexHandle = nullptr;
+    }
+
+    std::uint8_t * decompressedBitmap = decompressFontBitmap(DD_CONTEXT->allocator);
+    if (decompressedBitmap == nullptr)
+    {
+        return; // Failed to decompressed. No font rendering available.
+    }
+
+    DD_CONTEXT->glyphTexHandle = DD_CONTEXT->renderInterface->createGlyphTexture(
+                                        getFontCharSet().bitmapWidth,
+                                        getFontCharSet().bitmapHeight,
+                                        decompressedBitmap);
+
+    // No longer needed.
+    freeMemory(DD_CONTEXT->allocator, decompressedBitmap, getFontCharSet().bitmapDecompressSize, AllocTagFont);
+}
+
+// ========================================================
+// Frame snapshots:
+// ========================================================
+
+// Makes room for 'required' bytes in a snapshot buffer, doubling its size as needed.
+// Returns false if out of memory, leaving the buffer as it was.
+static bool reserveSnapshotBytes(Allocator * allocator, SnapshotBuffer & buffer, const std::size_t required)
+{
+    if (required <= buffer.capacity)
+    {
+        return true;
+    }
+
+    std::size_t newCapacity = (buffer.capacity != 0) ? buffer.capacity : 4096;
+    while (newCapacity < required)
+    {
+        newCapacity *= 2;
+    }
+
+    unsigned char * newData = static_cast<unsigned char *>(allocMemory(allocator, newCapacity, 16, AllocTagSnapshots));
+    if (newData == nullptr)
+    {
+        return false;
+    }
+
+    if (buffer.used != 0)
+    {
+        std::memcpy(newData, buffer.data, buffer.used);
+    }
+    freeMemory(allocator, buffer.data, buffer.capacity, AllocTagSnapshots);
+
+    buffer.data     = newData;
+    buffer.capacity = newCapacity;
+    return true;
+}
+
+static void freeSnapshotBuffer(Allocator * allocator, SnapshotBuffer & buffer)
+{
+    freeMemory(allocator, buffer.data, buffer.capacity, AllocTagSnapshots);
+    buffer = SnapshotBuffer();
+}
+
+static void freeFrameSnapshot(Allocator * allocator, FrameSnapshot & frame)
+{
+    freeSnapshotBuffer(allocator, frame.ranges);
+    freeSnapshotBuffer(allocator, frame.vertexes);
+    freeSnapshotBuffer(allocator, frame.indexes);
+}
+
+static std::size_t getFrameSnapshotBytes(const FrameSnapshot & frame)
+{
+    return frame.ranges.capacity + frame.vertexes.capacity + frame.indexes.capacity;
+}
+
+static void destroySnapshots(Allocator * allocator, SnapshotState * state)
+{
+    if (state == nullptr)
+    {
+        return;
+    }
+
+    for (int i = 0; i < 3; ++i)
+    {
+        freeFrameSnapshot(allocator, state->frames[i]);
+    }
+    state->~SnapshotState();
+    freeMemory(allocator, state, sizeof(SnapshotState), AllocTagSnapshots);
+}
+
+static std::size_t getSnapshotReservedBytes(const SnapshotState * state)
+{
+    if (state == nullptr)
+    {
+        return 0;
+    }
+
+    std::size_t bytes = sizeof(SnapshotState);
+    for (int i = 0; i < 3; ++i)
+    {
+        bytes += getFrameSnapshotBytes(state->frames[i]);
+    }
+    return bytes;
+}
+
+// Stands in for the context's renderer while dd::endFrame() records a snapshot, or while
+// dd::flush() gathers a frame for RenderInterface::submitFrame(). Vertex batches are written
+// straight into the frame through acquireVertices(), and each one becomes a dd::DrawRange.
+class FrameRecorder final
+    : public RenderInterface
+{
+public:
+
+    bool outOfMemory; // Set if anything had to be dropped.
+
+    FrameRecorder(FrameSnapshot & f, Allocator * a, const std::size_t indexSize, const bool merge)
+        : outOfMemory(false)
+        , frame(f)
+        , allocator(a)
+        , indexSizeBytes(indexSize)
+        , mergeRanges(merge)
+        , currentLayer(0)
+    { }
+
+    void beginLayer(const int layer) override
+    {
+        currentLayer = layer;
+    }
+
+    void * acquireVertices(PrimitiveType, const int maxCount) override
+    {
+        if (!reserveSnapshotBytes(allocator, frame.vertexes, frame.vertexes.used + sizeof(DrawVertex) * maxCount))
+        {
+            // The batch goes to our no-op draw*List() methods instead, so it is lost.
+            outOfMemory = true;
+            return nullptr;
+        }
+        return frame.vertexes.data + frame.vertexes.used;
+    }
+
+    void commitVertices(const VertexBatch & batch) override
+    {
+        const std::size_t vertexBytes = batch.count * ((batch.format == VertexFormatCompact) ? sizeof(CompactVertex) : sizeof(DrawVertex));
+        const std::size_t indexBytes  = batch.indexCount * indexSizeBytes;
+
+        // Batches are written back to back, so a non-indexed batch with the
+        // same state as the previous range can simply extend it.
+        if (mergeRanges && batch.indexCount == 0 && frame.ranges.used != 0)
+        {
+            DrawRange & last = *reinterpret_cast<DrawRange *>(frame.ranges.data + frame.ranges.used - sizeof(DrawRange));
+            if (last.batch.indexCount   == 0                  &&
+                last.layer              == currentLayer       &&
+                last.batch.type         == batch.type         &&
+                last.batch.format       == batch.format       &&
+                last.batch.depthEnabled == batch.depthEnabled &&
+                last.batch.pointSize    == batch.pointSize    &&
+                last.batch.glyphTex     == batch.glyphTex)
+            {
+                last.batch.count    += batch.count;
+                frame.vertexes.used += vertexBytes;
+                return;
+            }
+        }
+
+        if (!reserveSnapshotBytes(allocator, frame.indexes, frame.indexes.used + indexBytes) ||
+            !reserveSnapshotBytes(allocator, frame.ranges,  frame.ranges.used  + sizeof(DrawRange)))
+        {
+            outOfMemory = true;
+            return;
+        }
+
+        DrawRange & range    = *reinterpret_cast<DrawRange *>(frame.ranges.data + frame.ranges.used);
+        range.batch          = batch;
+        range.batch.indexes  = nullptr;
+        range.layer          = currentLayer;
+        range.vertexOffset   = frame.vertexes.used;
+        range.indexOffset    = frame.indexes.used;
+        frame.ranges.used   += sizeof(DrawRange);
+
+        if (indexBytes != 0)
+        {
+            std::memcpy(frame.indexes.data + frame.indexes.used, batch.indexes, indexBytes);
+        }
+        frame.vertexes.used += vertexBytes;
+        frame.indexes.used  += indexBytes;
+    }
+
+private:
+
+    FrameSnapshot &   frame;
+    Allocator *       allocator;
+    const std::size_t indexSizeBytes;
+    const bool        mergeRanges; // Only if the frame goes to RenderInterface::submitFrame(), as merged
+                                   // ranges can be larger than RenderInterface::getMaxBatchSize().
+    int               currentLayer;
+};
+
+static void resetFrameSnapshot(FrameSnapshot & frame)
+{
+    frame.ranges.used   = 0;
+    frame.vertexes.used = 0;
+    frame.indexes.used  = 0;
+}
+
+// Sends a recorded frame to the renderer, through acquireVertices()/commitVertices()
+// if the renderer supports it, or the draw*List() methods otherwise.
+static void replayFrameSnapshot(RenderInterface * renderer, const FrameSnapshot & frame)
+{
+    const int numRanges = static_cast<int>(frame.ranges.used / sizeof(DrawRange));
+    if (numRanges == 0)
+    {
+        return;
+    }
+
+    const DrawRange * ranges = reinterpret_cast<const DrawRange *>(frame.ranges.data);
+    int layer = -1;
+
+    renderer->beginDraw();
+    for (int r = 0; r < numRanges; ++r)
+    {
+        const DrawRange & range = ranges[r];
+        if (range.layer != layer)
+        {
+            layer = range.layer;
+            renderer->beginLayer(layer);
+        }
+
+        VertexBatch batch = range.batch;
+        batch.indexes = (batch.indexCount != 0) ? frame.indexes.data + range.indexOffset : nullptr;
+
+        const void * verts = frame.vertexes.data + range.vertexOffset;
+        void * dest = renderer->acquireVertices(batch.type, batch.count);
+        if (dest != nullptr)
+        {
+            const std::size_t vertexBytes = batch.count * ((batch.format == VertexFormatCompact) ? sizeof(CompactVertex) : sizeof(DrawVertex));
+            std::memcpy(dest, verts, vertexBytes);
+            renderer->commitVertices(batch);
+        }
+        else
+        {
+            drawVertexBatch(renderer, batch, verts);
+        }
+    }
+    renderer->endDraw();
+}
+
+// Sends a recorded frame to the renderer in a single RenderInterface::submitFrame() call.
+static void submitFrameSnapshot(RenderInterface * renderer, const FrameSnapshot & frame)
+{
+    const int numRanges = static_cast<int>(frame.ranges.used / sizeof(DrawRange));
+    if (numRanges == 0)
+    {
+        return;
+    }
+
+    FrameSubmission submission;
+    submission.vertexes    = frame.vertexes.data;
+    submission.vertexBytes = frame.vertexes.used;
+    submission.indexes     = (frame.indexes.used != 0) ? frame.indexes.data : nullptr;
+    submission.indexBytes  = frame.indexes.used;
+    submission.ranges      = reinterpret_cast<const DrawRange *>(frame.ranges.data);
+    submission.numRanges   = numRanges;
+    renderer->submitFrame(submission);
+}
+
+// ========================================================
+// Flush slices:
+// ========================================================
+
+// Slice bound that nothing queued can reach.
+static const int UnlimitedSlice = INT32_MAX;
+
+// A regular dd::flush() draws everything queued.
+static void setFullFlushSlice(FlushSlice & slice)
+{
+    slice.transientLeft        = UnlimitedSlice;
+    slice.timedFirst           = 0;
+    slice.timedLast            = UnlimitedSlice;
+    slice.timedSeen            = 0;
+    slice.timedDrawn           = 0;
+    slice.transientTimeLimited = false;
+}
+
+// Timed elements [cursor, cursor + count) of a budgeted dd::flush(), not wrapping around
+// the end of the queue, so they are drawn in draw order and a time budget cuts them short
+// at the right place. The next call starts over from the first element. If all of them fit,
+// as told by 'timedCost', the most elements they can take from the budget, and there is no
+// time budget to cut them short, they are drawn from the first one.
+static void setTimedFlushSlice(FlushSlice & slice, int cursor, const int timedCount, const std::int64_t timedCost,
+                               const std::int64_t count, const bool timeLimited)
+{
+    if ((count >= timedCost && !timeLimited) || cursor >= timedCount)
+    {
+        cursor = 0;
+    }
+
+    slice.timedFirst = cursor;
+    slice.timedLast  = (count < UnlimitedSlice - cursor) ? cursor + static_cast<int>(count) : UnlimitedSlice;
+    slice.timedSeen  = 0;
+    slice.timedDrawn = 0;
+}
+
+static int getNextDrawCursor(const FlushSlice & slice, const int timedCount)
+{
+    const int next = slice.timedFirst + slice.timedDrawn;
+    return (next < timedCount) ? next : 0;
+}
+
+// Splits a vertex budget between points and lines, in proportion to how many vertexes each wants.
+static void splitVertexBudget(const std::int64_t budget, const std::int64_t pointVerts, const std::int64_t lineVerts,
+                              std::int64_t & outPointVerts, std::int64_t & outLineVerts)
+{
+    const std::int64_t total = pointVerts + lineVerts;
+    if (total <= budget)
+    {
+        outPointVerts = pointVerts;
+        outLineVerts  = lineVerts;
+        return;
+    }
+
+    outPointVerts = budget * pointVerts / total;
+    outLineVerts  = budget - outPointVerts;
+}
+
+static void drawQueues(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const std::uint32_t flags)
+{
+    DD_CONTEXT->flushCullTimed = (flags & FlushCullTimed) && DD_CONTEXT->cullingEnabled;
+
+    // Let the user set common render states.
+    DD_CONTEXT->renderInterface->beginDraw();
+
+    // Issue the render calls, one layer at a time:
+    for (int layer = 0; layer < DEBUG_DRAW_RENDER_LAYERS; ++layer)
+    {
+        // Shapes are expanded along with the lines, unless drawn instanced.
+        const bool hasShapes    = (flags & FlushLines)  && hasLayerElements(DD_CONTEXT->debugShapes,  layer);
+        const bool hasInstances = hasShapes && DD_CONTEXT->instancedShapes;
+        const bool hasLines     = ((flags & FlushLines) && hasLayerElements(DD_CONTEXT->debugLines,   layer)) || (hasShapes && !hasInstances);
+        const bool hasPoints    = (flags & FlushPoints) && hasLayerElements(DD_CONTEXT->debugPoints,  layer);
+        const bool hasStrings   = (flags & FlushText)   && hasLayerElements(DD_CONTEXT->debugStrings, layer);
+        if (!hasLines && !hasInstances && !hasPoints && !hasStrings)
+        {
+            continue;
+        }
+
+        DD_CONTEXT->renderInterface->beginLayer(layer);
+        if (hasLines)     { drawDebugLines(DD_EXPLICIT_CONTEXT_ONLY(ctx,) layer);   }
+        if (hasInstances) { drawDebugShapes(DD_EXPLICIT_CONTEXT_ONLY(ctx,) layer);  }
+        if (hasPoints)    { drawDebugPoints(DD_EXPLICIT_CONTEXT_ONLY(ctx,) layer);  }
+        if (hasStrings)   { drawDebugStrings(DD_EXPLICIT_CONTEXT_ONLY(ctx,) layer); }
+    }
+
+    // And cleanup if needed.
+    DD_CONTEXT->renderInterface->endDraw();
+}
+
+// Shared by both dd::flush() overloads, once the slices to draw are set.
+static void drawAndExpireQueues(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const std::int64_t currTimeMillis, const std::uint32_t flags)
+{
+    // Save the last know time value for next dd::line/dd::point calls.
+    DD_CONTEXT->currentTimeMillis = currTimeMillis;
+
+    if (DD_CONTEXT->frameSubmission && !DD_CONTEXT->recordingFrame)
+    {
+        // Gather the whole frame, then hand it to the renderer in one call.
+        RenderInterface * renderer = DD_CONTEXT->renderInterface;
+        FrameSnapshot & frame = DD_CONTEXT->submissionFrame;
+        resetFrameSnapshot(frame);
+
+        FrameRecorder recorder(frame, DD_CONTEXT->allocator, getIndexBufferBytes(DD_CONTEXT->indexFormat, 1), true);
+        DD_CONTEXT->renderInterface = &recorder;
+        DD_CONTEXT->recordingFrame  = true;
+        drawQueues(DD_EXPLICIT_CONTEXT_ONLY(ctx,) flags);
+        DD_CONTEXT->renderInterface = renderer;
+        DD_CONTEXT->recordingFrame  = false;
+
+        if (recorder.outOfMemory)
+        {
+            DEBUG_DRAW_OVERFLOWED("Out of memory for the submitted frame! Dropping some debug draws.");
+        }
+        submitFrameSnapshot(renderer, frame);
+    }
+    else
+    {
+        drawQueues(DD_EXPLICIT_CONTEXT_ONLY(ctx,) flags);
+    }
+
+    // Remove all expired objects, regardless of draw flags:
+    clearDebugQueue(DD_EXPLICIT_CONTEXT_ONLY(ctx,) DD_CONTEXT->debugStrings);
+    clearDebugQueue(DD_EXPLICIT_CONTEXT_ONLY(ctx,) DD_CONTEXT->debugPoints);
+    clearDebugQueue(DD_EXPLICIT_CONTEXT_ONLY(ctx,) DD_CONTEXT->debugLines);
+    clearDebugQueue(DD_EXPLICIT_CONTEXT_ONLY(ctx,) DD_CONTEXT->debugShapes);
+    compactTextArena(DD_EXPLICIT_CONTEXT_ONLY(ctx));
+}
+
+// ========================================================
+// Public Debug Draw interface:
+// ========================================================
+
+bool initialize(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle * outCtx,) RenderInterface * renderer)
+{
+    return initialize(DD_EXPLICIT_CONTEXT_ONLY(outCtx,) renderer, ContextConfig());
+}
+
+bool initialize(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle * outCtx,) RenderInterface * renderer, const ContextConfig & config)
+{
+    if (renderer == nullptr)
+    {
+        return false;
+    }
+
+    // Need room for at least one glyph quad (6 verts) plus the one slot we always keep spare.
+    if (config.vertexBufferSize < 8 || config.maxStrings < 0 || config.maxPoints < 0 ||
+        config.maxLines < 0 || config.maxShapes < 0 || config.textArenaSize < 0)
+    {
+        return false;
+    }
+
+    void * memory = allocMemory(config.allocator, sizeof(InternalContext), alignof(InternalContext), AllocTagContext);
+    if (memory == nullptr)
+    {
+        return false;
+    }
+
+    InternalContext * newCtx = ::new(memory) InternalContext(renderer, config);
+
+    // The renderer has the final word on the batch size.
+    const int preferredBatchSize = renderer->getPreferredBatchSize();
+    const int maxBatchSize       = renderer->getMaxBatchSize();
+    if (preferredBatchSize > 0)
+    {
+        newCtx->vertexBufferSize = preferredBatchSize;
+    }
+    if (maxBatchSize > 0 && newCtx->vertexBufferSize > maxBatchSize)
+    {
+        newCtx->vertexBufferSize = maxBatchSize;
+    }
+
+    // 16-bits indexes can't address more vertexes than this in a batch.
+    if (newCtx->indexFormat == IndexFormat16 && newCtx->vertexBufferSize > 65536)
+    {
+        newCtx->vertexBufferSize = 65536;
+    }
+
+    if (newCtx->vertexBufferSize < 8)
+    {
+        newCtx->~InternalContext();
+        freeMemory(config.allocator, newCtx, sizeof(InternalContext), AllocTagContext);
+        return false;
+    }
+
+    // The vertex buffer is shared by both vertex formats, so it is aligned
+    // and sized for the largest of dd::DrawVertex and dd::CompactVertex.
+    const std::size_t vertexBufferBytes = sizeof(DrawVertex) * newCtx->vertexBufferSize;
+    newCtx->localVertexBuffer = static_cast<DrawVertex *>(allocMemory(config.allocator, vertexBufferBytes, 16, AllocTagVertexBuffer));
+    newCtx->vertexBuffer = newCtx->localVertexBuffer;
+    newCtx->compactVertexBuffer = reinterpret_cast<CompactVertex *>(newCtx->localVertexBuffer);
+
+    // Deduplicated lines can take up to 3 indexes per vertex (e.g. a box), so
+    // twice as many indexes as vertexes keeps both buffers reasonably used.
+    std::size_t indexBufferBytes = 0;
+    if (newCtx->indexFormat != IndexFormatNone)
+    {
+        newCtx->indexBufferSize = newCtx->vertexBufferSize * 2;
+        indexBufferBytes = getIndexBufferBytes(newCtx->indexFormat, newCtx->indexBufferSize);
+        newCtx->indexBuffer = allocMemory(config.allocator, indexBufferBytes, 16, AllocTagVertexBuffer);
+    }
+
+    // The snapshot buffers themselves are only allocated by dd::endFrame(), sized to fit.
+    if (config.frameSnapshots)
+    {
+        void * snapshotMemory = allocMemory(config.allocator, sizeof(SnapshotState), alignof(SnapshotState), AllocTagSnapshots);
+        if (snapshotMemory != nullptr)
+        {
+            newCtx->snapshots = ::new(snapshotMemory) SnapshotState(renderer);
+        }
+    }
+
+    // Frame snapshots and frame submission only carry vertexes, so they get the shapes as lines.
+    std::size_t shapeBatchBytes = 0;
+    if (renderer->wantsInstancedShapes() && !config.frameSnapshots && !newCtx->frameSubmission)
+    {
+        newCtx->instancedShapes = true;
+        shapeBatchBytes = getShapeBatchBytes(true);
+        newCtx->shapeBatches = static_cast<ShapeInstance *>(allocMemory(config.allocator, shapeBatchBytes, alignof(ShapeInstance),
+                                                                        AllocTagVertexBuffer));
+    }
+
+    // Pre-allocate the queue chunks and text arena for the configured
+    // sizes, so we don't have to allocate anything else unless growing them.
+    if (newCtx->localVertexBuffer == nullptr ||
+        (newCtx->indexFormat != IndexFormatNone && newCtx->indexBuffer == nullptr) ||
+        (config.frameSnapshots && newCtx->snapshots == nullptr) ||
+        (newCtx->instancedShapes && newCtx->shapeBatches == nullptr) ||
+        !reserveQueueChunks(newCtx->debugStrings, config.maxStrings) ||
+        !reserveQueueChunks(newCtx->debugPoints,  config.maxPoints)  ||
+        !reserveQueueChunks(newCtx->debugLines,   config.maxLines)   ||
+        !reserveQueueChunks(newCtx->debugShapes,  config.maxShapes)  ||
+        (config.textArenaSize > 0 && !allocTextArena(config.allocator, newCtx->textArena,
+                                                     newCtx->textArenaBack, config.textArenaSize)) ||
+        (newCtx->instancedShapes && !createShapeMeshes(renderer, config.allocator)))
+    {
+        destroyQueue(newCtx->debugStrings);
+        destroyQueue(newCtx->debugPoints);
+        destroyQueue(newCtx->debugLines);
+        destroyQueue(newCtx->debugShapes);
+        freeMemory(config.allocator, newCtx->localVertexBuffer, vertexBufferBytes, AllocTagVertexBuffer);
+        freeMemory(config.allocator, newCtx->indexBuffer, indexBufferBytes, AllocTagVertexBuffer);
+        freeMemory(config.allocator, newCtx->shapeBatches, shapeBatchBytes, AllocTagVertexBuffer);
+        freeTextArena(config.allocator, newCtx->textArena, newCtx->textArenaBack, config.textArenaSize);
+        destroySnapshots(config.allocator, newCtx->snapshots);
+        newCtx->~InternalContext();
+        freeMemory(config.allocator, newCtx, sizeof(InternalContext), AllocTagContext);
+        return false;
+    }
+
+    #ifdef DEBUG_DRAW_EXPLICIT_CONTEXT
+    if ((*outCtx) != nullptr) { shutdown(*outCtx); }
+    (*outCtx) = newCtx;
     #else // !DEBUG_DRAW_EXPLICIT_CONTEXT
     if (DD_CONTEXT != nullptr) { shutdown(); }
     DD_CONTEXT = newCtx;
     #endif // DEBUG_DRAW_EXPLICIT_CONTEXT
 
-    setupGlyphTexture(DD_EXPLICIT_CONTEXT_ONLY(*outCtx));
+    setupGlyphTexture(DD_EXPLICIT_CONTEXT_ONLY(*outCtx));
+    return true;
+}
+
+void shutdown(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx))
+{
+    if (DD_CONTEXT != nullptr)
+    {
+        if (DD_CONTEXT->renderInterface != nullptr && DD_CONTEXT->glyphTexHandle != nullptr)
+        {
+            DD_CONTEXT->renderInterface->destroyGlyphTexture(DD_CONTEXT->glyphTexHandle);
+        }
+
+        destroyQueue(DD_CONTEXT->debugStrings);
+        destroyQueue(DD_CONTEXT->debugPoints);
+        destroyQueue(DD_CONTEXT->debugLines);
+        destroyQueue(DD_CONTEXT->debugShapes);
+
+        Allocator * allocator = DD_CONTEXT->allocator;
+        freeTextArena(allocator, DD_CONTEXT->textArena, DD_CONTEXT->textArenaBack, DD_CONTEXT->textArenaSize);
+        freeMemory(allocator, DD_CONTEXT->localVertexBuffer, sizeof(DrawVertex) * DD_CONTEXT->vertexBufferSize, AllocTagVertexBuffer);
+        freeMemory(allocator, DD_CONTEXT->indexBuffer, getIndexBufferBytes(DD_CONTEXT->indexFormat, DD_CONTEXT->indexBufferSize),
+                   AllocTagVertexBuffer);
+        freeMemory(allocator, DD_CONTEXT->shapeBatches, getShapeBatchBytes(DD_CONTEXT->instancedShapes), AllocTagVertexBuffer);
+        destroySnapshots(allocator, DD_CONTEXT->snapshots);
+        freeFrameSnapshot(allocator, DD_CONTEXT->submissionFrame);
+
+        DD_CONTEXT->~InternalContext(); // Destroy first
+        freeMemory(allocator, DD_CONTEXT, sizeof(InternalContext), AllocTagContext);
+
+        #ifndef DEBUG_DRAW_EXPLICIT_CONTEXT
+        DD_CONTEXT = nullptr;
+        #endif // DEBUG_DRAW_EXPLICIT_CONTEXT
+    }
+}
+
+bool isInitialized(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx))
+{
+    return (DD_CONTEXT != nullptr && DD_CONTEXT->renderInterface != nullptr);
+}
+
+bool hasPendingDraws(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx))
+{
+    if (!isInitialized(DD_EXPLICIT_CONTEXT_ONLY(ctx)))
+    {
+        return false;
+    }
+    return (DD_CONTEXT->debugStrings.count + DD_CONTEXT->debugPoints.count +
+            DD_CONTEXT->debugLines.count + DD_CONTEXT->debugShapes.count) > 0;
+}
+
+void flush(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const std::int64_t currTimeMillis, const std::uint32_t flags)
+{
+    if (!hasPendingDraws(DD_EXPLICIT_CONTEXT_ONLY(ctx)))
+    {
+        return;
+    }
+
+    setFullFlushSlice(DD_CONTEXT->pointSlice);
+    setFullFlushSlice(DD_CONTEXT->lineSlice);
+    drawAndExpireQueues(DD_EXPLICIT_CONTEXT_ONLY(ctx,) currTimeMillis, flags);
+}
+
+void flush(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const std::int64_t currTimeMillis,
+           const FlushBudget & budget, const std::uint32_t flags)
+{
+    if (!hasPendingDraws(DD_EXPLICIT_CONTEXT_ONLY(ctx)))
+    {
+        return;
+    }
+
+    DebugQueue<DebugPointArrays> & points = DD_CONTEXT->debugPoints;
+    DebugQueue<DebugLineArrays>  & lines  = DD_CONTEXT->debugLines;
+    const DebugQueue<DebugShapeArrays> & shapes = DD_CONTEXT->debugShapes;
+
+    // Vertexes each part of the queues would take without a budget.
+    const std::int64_t transientPointVerts = (flags & FlushPoints) ? points.transientCount : 0;
+    std::int64_t transientLineVerts = (flags & FlushLines) ? lines.transientCount * 2 : 0;
+    const int timedPoints = (flags & FlushPoints) ? points.count - points.transientCount : 0;
+    int timedLines        = (flags & FlushLines)  ? lines.count  - lines.transientCount  : 0;
+    std::int64_t timedLineVerts = static_cast<std::int64_t>(timedLines) * 2;
+    std::int64_t timedLineCost  = timedLines;
+
+    // Shapes expanded into lines share the line budget. Each takes a single place among the
+    // timed lines the cursor walks, but is charged the lines it expands into, estimated here
+    // at their fixed steps. Whether the slice covers all of them is decided on the most lines
+    // the screen-space LOD can expand them into, so the last ones can't be left out for good.
+    if ((flags & FlushLines) && !DD_CONTEXT->instancedShapes)
+    {
+        const bool lodBound = (DD_CONTEXT->lodPixelScaleSq > 0.0f);
+        for (int partition = 0; partition < NumQueuePartitions; ++partition)
+        {
+            transientLineVerts += getShapeChunkLineCount(shapes.transient[partition].head, false) * 2;
+            for (const DebugQueue<DebugShapeArrays>::Bucket * bucket = shapes.buckets; bucket != nullptr; bucket = bucket->next)
+            {
+                const std::int64_t numLines = getShapeChunkLineCount(bucket->chunks[partition].head, false);
+                timedLineVerts += numLines * 2;
+                timedLineCost  += lodBound ? getShapeChunkLineCount(bucket->chunks[partition].head, true) : numLines;
+            }
+        }
+        timedLines += shapes.count - shapes.transientCount;
+    }
+
+    std::int64_t budgetLeft = transientPointVerts + transientLineVerts + timedPoints + timedLineVerts;
+    if (budget.maxVertexes > 0 && budget.maxVertexes < budgetLeft)
+    {
+        budgetLeft = budget.maxVertexes;
+    }
+
+    // Transient elements first, then whatever is left of the budget goes to the timed ones.
+    std::int64_t pointVerts, lineVerts;
+    if (budget.transientFirst)
+    {
+        pointVerts = transientPointVerts;
+        lineVerts  = transientLineVerts;
+        budgetLeft = (budgetLeft > pointVerts + lineVerts) ? budgetLeft - pointVerts - lineVerts : 0;
+    }
+    else
+    {
+        splitVertexBudget(budgetLeft, transientPointVerts, transientLineVerts, pointVerts, lineVerts);
+        budgetLeft -= pointVerts + lineVerts;
+    }
+    DD_CONTEXT->pointSlice.transientLeft = budget.transientFirst ? UnlimitedSlice : static_cast<int>(pointVerts);
+    DD_CONTEXT->lineSlice.transientLeft  = budget.transientFirst ? UnlimitedSlice : static_cast<int>(lineVerts / 2);
+    DD_CONTEXT->pointSlice.transientTimeLimited = !budget.transientFirst;
+    DD_CONTEXT->lineSlice.transientTimeLimited  = !budget.transientFirst;
+
+    const bool timeLimited = (budget.maxMicroseconds > 0);
+    splitVertexBudget(budgetLeft, timedPoints, timedLineVerts, pointVerts, lineVerts);
+    setTimedFlushSlice(DD_CONTEXT->pointSlice, points.drawCursor, timedPoints, timedPoints,   pointVerts,     timeLimited);
+    setTimedFlushSlice(DD_CONTEXT->lineSlice,  lines.drawCursor,  timedLines,  timedLineCost, lineVerts / 2, timeLimited);
+
+    DD_CONTEXT->flushDeadlineMicros = timeLimited ? getFlushClockMicros() + budget.maxMicroseconds : 0;
+    DD_CONTEXT->flushOutOfTime      = false;
+
+    drawAndExpireQueues(DD_EXPLICIT_CONTEXT_ONLY(ctx,) currTimeMillis, flags);
+
+    DD_CONTEXT->flushDeadlineMicros = 0;
+    DD_CONTEXT->flushOutOfTime      = false;
+
+    // The next call resumes after the last timed element drawn, or wraps around.
+    if (flags & FlushPoints)
+    {
+        points.drawCursor = getNextDrawCursor(DD_CONTEXT->pointSlice, timedPoints);
+    }
+    if (flags & FlushLines)
+    {
+        lines.drawCursor = getNextDrawCursor(DD_CONTEXT->lineSlice, timedLines);
+    }
+}
+
+void endFrame(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const std::int64_t currTimeMillis)
+{
+    if (!isInitialized(DD_EXPLICIT_CONTEXT_ONLY(ctx)) || DD_CONTEXT->snapshots == nullptr)
+    {
+        return;
+    }
+
+    SnapshotState & state = *DD_CONTEXT->snapshots;
+    FrameSnapshot & frame = state.frames[state.backIndex];
+    resetFrameSnapshot(frame);
+
+    // A regular flush, but with the draws recorded into the back frame.
+    FrameRecorder recorder(frame, DD_CONTEXT->allocator, getIndexBufferBytes(DD_CONTEXT->indexFormat, 1),
+                           DD_CONTEXT->frameSubmission);
+    DD_CONTEXT->renderInterface = &recorder;
+    DD_CONTEXT->recordingFrame  = true;
+    flush(DD_EXPLICIT_CONTEXT_ONLY(ctx,) currTimeMillis, FlushAll);
+    DD_CONTEXT->renderInterface = state.renderer;
+    DD_CONTEXT->recordingFrame  = false;
+
+    if (recorder.outOfMemory)
+    {
+        DEBUG_DRAW_OVERFLOWED("Out of memory for the frame snapshot! Dropping some debug draws.");
+    }
+
+    // Publish it. We get back either the frame dd::flushSnapshot() is done
+    // with or, if it didn't run since the last publish, the skipped frame.
+    state.backIndex = state.latest.exchange(state.backIndex | SnapshotNewBit, std::memory_order_acq_rel) & SnapshotIndexMask;
+}
+
+void flushSnapshot(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx))
+{
+    // Only touches the snapshot state and frameSubmission, fixed from dd::initialize() to dd::shutdown().
+    // The renderInterface of the context is swapped by dd::endFrame() and can't be used here.
+    if (DD_CONTEXT == nullptr || DD_CONTEXT->snapshots == nullptr)
+    {
+        return;
+    }
+
+    SnapshotState & state = *DD_CONTEXT->snapshots;
+    if (state.latest.load(std::memory_order_relaxed) & SnapshotNewBit)
+    {
+        state.frontIndex = state.latest.exchange(state.frontIndex, std::memory_order_acq_rel) & SnapshotIndexMask;
+    }
+
+    if (DD_CONTEXT->frameSubmission)
+    {
+        submitFrameSnapshot(state.renderer, state.frames[state.frontIndex]);
+    }
+    else
+    {
+        replayFrameSnapshot(state.renderer, state.frames[state.frontIndex]);
+    }
+}
+
+void clear(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx))
+{
+    if (!isInitialized(DD_EXPLICIT_CONTEXT_ONLY(ctx)))
+    {
+        return;
+    }
+
+    DD_CONTEXT->vertexBufferUsed = 0;
+    resetQueue(DD_CONTEXT->debugStrings);
+    resetQueue(DD_CONTEXT->debugPoints);
+    resetQueue(DD_CONTEXT->debugLines);
+    resetQueue(DD_CONTEXT->debugShapes);
+    DD_CONTEXT->textArenaUsed = 0;
+}
+
+bool getMemoryStats(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) MemoryStats * outStats)
+{
+    if (!isInitialized(DD_EXPLICIT_CONTEXT_ONLY(ctx)) || outStats == nullptr)
+    {
+        return false;
+    }
+
+    MemoryStats & stats = *outStats;
+    getQueueMemoryStats(DD_CONTEXT->debugStrings, stats.strings);
+    getQueueMemoryStats(DD_CONTEXT->debugPoints,  stats.points);
+    getQueueMemoryStats(DD_CONTEXT->debugLines,   stats.lines);
+    getQueueMemoryStats(DD_CONTEXT->debugShapes,  stats.shapes);
+
+    // Same sizes dd::initialize() allocated.
+    stats.vertexBufferBytes       = sizeof(DrawVertex) * DD_CONTEXT->vertexBufferSize +
+                                    getIndexBufferBytes(DD_CONTEXT->indexFormat, DD_CONTEXT->indexBufferSize) +
+                                    getShapeBatchBytes(DD_CONTEXT->instancedShapes);
+    stats.contextBytes            = sizeof(InternalContext) + stats.vertexBufferBytes;
+    stats.textArenaReservedBytes  = static_cast<std::size_t>(DD_CONTEXT->textArenaSize) * 2;
+    stats.textArenaUsedBytes      = DD_CONTEXT->textArenaUsed;
+    stats.textArenaHighWaterBytes = DD_CONTEXT->textArenaHighWater;
+    stats.snapshotReservedBytes   = getSnapshotReservedBytes(DD_CONTEXT->snapshots) + getFrameSnapshotBytes(DD_CONTEXT->submissionFrame);
+
+    stats.totalReservedBytes = stats.contextBytes + stats.textArenaReservedBytes + stats.snapshotReservedBytes +
+                               stats.strings.reservedBytes + stats.points.reservedBytes + stats.lines.reservedBytes +
+                               stats.shapes.reservedBytes;
+    stats.totalUsedBytes     = stats.contextBytes + stats.textArenaUsedBytes +
+                               stats.strings.usedBytes + stats.points.usedBytes + stats.lines.usedBytes +
+                               stats.shapes.usedBytes;
     return true;
 }
 
-void shutdown(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx))
+void trim(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx))
 {
-    if (DD_CONTEXT != nullptr)
+    if (!isInitialized(DD_EXPLICIT_CONTEXT_ONLY(ctx)))
     {
-        // If this macro is defined, the user-provided ddStr type
-        // needs some extra cleanup before shutdown, so we run for
-        // all entries in the debugStrings[] array.
-        //
-        // We could call std::string::clear() here, but clear()
-        // doesn't deallocate memory in std string, so we might
-        // as well let the default destructor do the cleanup,
-        // when using the default (AKA std::string) ddStr.
-        #ifdef DEBUG_DRAW_STR_DEALLOC_FUNC
-        for (int i = 0; i < DEBUG_DRAW_MAX_STRINGS; ++i)
-        {
-            DEBUG_DRAW_STR_DEALLOC_FUNC(DD_CONTEXT->debugStrings[i].text);
-        }
-        #endif // DEBUG_DRAW_STR_DEALLOC_FUNC
-
-        if (DD_CONTEXT->renderInterface != nullptr && DD_CONTEXT->glyphTexHandle != nullptr)
-        {
-            DD_CONTEXT->renderInterface->destroyGlyphTexture(DD_CONTEXT->glyphTexHandle);
-        }
+        return;
+    }
 
-        DD_CONTEXT->~InternalContext(); // Destroy first
-        DD_MFREE(DD_CONTEXT);
+    trimQueue(DD_CONTEXT->debugStrings);
+    trimQueue(DD_CONTEXT->debugPoints);
+    trimQueue(DD_CONTEXT->debugLines);
+    trimQueue(DD_CONTEXT->debugShapes);
 
-        #ifndef DEBUG_DRAW_EXPLICIT_CONTEXT
-        DD_CONTEXT = nullptr;
-        #endif // DEBUG_DRAW_EXPLICIT_CONTEXT
+    // The text arena only shrinks back to its initial size, and
+    // only if whatever text is still queued fits in that.
+    if (DD_CONTEXT->textArenaSize > DD_CONTEXT->textArenaReserved &&
+        DD_CONTEXT->textArenaUsed <= DD_CONTEXT->textArenaReserved)
+    {
+        resizeTextArena(DD_EXPLICIT_CONTEXT_ONLY(ctx,) DD_CONTEXT->textArenaReserved);
     }
 }
 
-bool isInitialized(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx))
+void setRenderLayer(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const int layer)
 {
-    return (DD_CONTEXT != nullptr && DD_CONTEXT->renderInterface != nullptr);
+    if (!isInitialized(DD_EXPLICIT_CONTEXT_ONLY(ctx)))
+    {
+        return;
+    }
+    if (layer >= 0 && layer < DEBUG_DRAW_RENDER_LAYERS)
+    {
+        DD_CONTEXT->renderLayer = layer;
+    }
 }
 
-bool hasPendingDraws(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx))
+int getRenderLayer(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx))
 {
     if (!isInitialized(DD_EXPLICIT_CONTEXT_ONLY(ctx)))
     {
-        return false;
+        return 0;
     }
-    return (DD_CONTEXT->debugStringsCount + DD_CONTEXT->debugPointsCount + DD_CONTEXT->debugLinesCount) > 0;
+    return DD_CONTEXT->renderLayer;
 }
 
-void flush(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const std::int64_t currTimeMillis, const std::uint32_t flags)
+void setView(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) ddMat4x4_In vpMatrix, const int sw, const int sh)
 {
-    if (!hasPendingDraws(DD_EXPLICIT_CONTEXT_ONLY(ctx)))
+    if (!isInitialized(DD_EXPLICIT_CONTEXT_ONLY(ctx)))
     {
         return;
     }
+    if (sw <= 0 || sh <= 0)
+    {
+        DD_CONTEXT->lodPixelScaleSq = 0.0f;
+        return;
+    }
 
-    // Save the last know time value for next dd::line/dd::point calls.
-    DD_CONTEXT->currentTimeMillis = currTimeMillis;
-
-    // Let the user set common render states.
-    DD_CONTEXT->renderInterface->beginDraw();
-
-    // Issue the render calls:
-    if (flags & FlushLines)  { drawDebugLines(DD_EXPLICIT_CONTEXT_ONLY(ctx));   }
-    if (flags & FlushPoints) { drawDebugPoints(DD_EXPLICIT_CONTEXT_ONLY(ctx));  }
-    if (flags & FlushText)   { drawDebugStrings(DD_EXPLICIT_CONTEXT_ONLY(ctx)); }
-
-    // And cleanup if needed.
-    DD_CONTEXT->renderInterface->endDraw();
+    for (int i = 0; i < 16; ++i)
+    {
+        DD_CONTEXT->viewProjMatrix[i] = vpMatrix[i];
+    }
 
-    // Remove all expired objects, regardless of draw flags:
-    clearDebugQueue(DD_EXPLICIT_CONTEXT_ONLY(ctx,) DD_CONTEXT->debugStrings, DD_CONTEXT->debugStringsCount);
-    clearDebugQueue(DD_EXPLICIT_CONTEXT_ONLY(ctx,) DD_CONTEXT->debugPoints,  DD_CONTEXT->debugPointsCount);
-    clearDebugQueue(DD_EXPLICIT_CONTEXT_ONLY(ctx,) DD_CONTEXT->debugLines,   DD_CONTEXT->debugLinesCount);
+    // Clip space X and Y span [-1,1] across the viewport, so a world unit is
+    // |row| * size / 2 pixels at W = 1. Keep the larger of the two axes.
+    const float xPixelsSq = (vpMatrix[0] * vpMatrix[0] + vpMatrix[4] * vpMatrix[4] + vpMatrix[8] * vpMatrix[8]) * (0.25f * sw * sw);
+    const float yPixelsSq = (vpMatrix[1] * vpMatrix[1] + vpMatrix[5] * vpMatrix[5] + vpMatrix[9] * vpMatrix[9]) * (0.25f * sh * sh);
+    DD_CONTEXT->lodPixelScaleSq = (xPixelsSq > yPixelsSq) ? xPixelsSq : yPixelsSq;
 }
 
-void clear(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx))
+void setCullingPlanes(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const float planes[6][4])
 {
     if (!isInitialized(DD_EXPLICIT_CONTEXT_ONLY(ctx)))
     {
         return;
     }
 
-    // Let the user cleanup the debug strings:
-    #ifdef DEBUG_DRAW_STR_DEALLOC_FUNC
-    for (int i = 0; i < DEBUG_DRAW_MAX_STRINGS; ++i)
+    DD_CONTEXT->cullStats = CullStats();
+    DD_CONTEXT->cullingEnabled = (planes != nullptr);
+    if (planes == nullptr)
+    {
+        return;
+    }
+
+    // Normalize by the length of the normal only, so distances are in world units.
+    // A degenerate plane becomes one that has everything inside.
+    for (int i = 0; i < 6; ++i)
+    {
+        float * plane = DD_CONTEXT->cullPlanes[i];
+        const float lengthSq = planes[i][0] * planes[i][0] + planes[i][1] * planes[i][1] + planes[i][2] * planes[i][2];
+        if (lengthSq < FloatEpsilon)
+        {
+            plane[0] = plane[1] = plane[2] = 0.0f;
+            plane[3] = 1.0f;
+            continue;
+        }
+
+        const float invLength = floatInvSqrt(lengthSq);
+        for (int c = 0; c < 4; ++c)
+        {
+            plane[c] = planes[i][c] * invLength;
+        }
+    }
+
+    // The same planes for cullSegments(), with the padding lanes never culling anything.
+    for (int i = 0; i < 8; ++i)
     {
-        DEBUG_DRAW_STR_DEALLOC_FUNC(DD_CONTEXT->debugStrings[i].text);
+        for (int c = 0; c < 4; ++c)
+        {
+            DD_CONTEXT->cullPlaneLanes[c][i] = (i < NumCullPlanes) ? DD_CONTEXT->cullPlanes[i][c] : ((c == 3) ? 1.0f : 0.0f);
+        }
+    }
+}
+
+bool getCullStats(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) CullStats * outStats)
+{
+    if (!isInitialized(DD_EXPLICIT_CONTEXT_ONLY(ctx)) || outStats == nullptr)
+    {
+        return false;
     }
-    #endif // DEBUG_DRAW_STR_DEALLOC_FUNC
 
-    DD_CONTEXT->vertexBufferUsed  = 0;
-    DD_CONTEXT->debugStringsCount = 0;
-    DD_CONTEXT->debugPointsCount  = 0;
-    DD_CONTEXT->debugLinesCount   = 0;
+    *outStats = DD_CONTEXT->cullStats;
+    return true;
 }
 
 void point(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) ddVec3_In pos, ddVec3_In color,
@@ -2658,19 +7142,20 @@ void point(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) ddVec3_In pos, ddVec3_In
         return;
     }
 
-    if (DD_CONTEXT->debugPointsCount == DEBUG_DRAW_MAX_POINTS)
+    const float position[3] = { pos[X], pos[Y], pos[Z] };
+
+    int index;
+    DebugPointArrays * points = pushQueueSlot(DD_CONTEXT->debugPoints, getQueuePartition(DD_CONTEXT->renderLayer, depthEnabled),
+                                              DD_CONTEXT->currentTimeMillis, durationMillis, position, 1, index);
+    if (points == nullptr)
     {
-        DEBUG_DRAW_OVERFLOWED("DEBUG_DRAW_MAX_POINTS limit reached! Dropping further debug point draws.");
+        DEBUG_DRAW_OVERFLOWED("Max debug points limit reached! Dropping further debug point draws.");
         return;
     }
 
-    DebugPoint & point     = DD_CONTEXT->debugPoints[DD_CONTEXT->debugPointsCount++];
-    point.expiryDateMillis = DD_CONTEXT->currentTimeMillis + durationMillis;
-    point.depthEnabled     = depthEnabled;
-    point.size             = size;
-
-    vecCopy(point.position, pos);
-    vecCopy(point.color, color);
+    points->sizes[index]  = size;
+    points->colors[index] = packColor(color);
+    storePositions(*points, index, position, 1);
 }
 
 void line(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) ddVec3_In from, ddVec3_In to,
@@ -2681,67 +7166,90 @@ void line(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) ddVec3_In from, ddVec3_In
         return;
     }
 
-    if (DD_CONTEXT->debugLinesCount == DEBUG_DRAW_MAX_LINES)
+    const float positions[6] = { from[X], from[Y], from[Z], to[X], to[Y], to[Z] };
+
+    int index;
+    DebugLineArrays * lines = pushQueueSlot(DD_CONTEXT->debugLines, getQueuePartition(DD_CONTEXT->renderLayer, depthEnabled),
+                                            DD_CONTEXT->currentTimeMillis, durationMillis, positions, 2, index);
+    if (lines == nullptr)
     {
-        DEBUG_DRAW_OVERFLOWED("DEBUG_DRAW_MAX_LINES limit reached! Dropping further debug line draws.");
+        DEBUG_DRAW_OVERFLOWED("Max debug lines limit reached! Dropping further debug line draws.");
         return;
     }
 
-    DebugLine & line      = DD_CONTEXT->debugLines[DD_CONTEXT->debugLinesCount++];
-    line.expiryDateMillis = DD_CONTEXT->currentTimeMillis + durationMillis;
-    line.depthEnabled     = depthEnabled;
+    lines->colors[index] = packColor(color);
+    storePositions(*lines, index, positions, 2);
+}
 
-    vecCopy(line.posFrom, from);
-    vecCopy(line.posTo, to);
-    vecCopy(line.color, color);
+static inline int stringLength(const char * str)
+{
+    int length = 0;
+    while (str[length] != '\0')
+    {
+        ++length;
+    }
+    return length;
 }
 
 void screenText(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const char * const str, ddVec3_In pos,
                 ddVec3_In color, const float scaling, const int durationMillis)
+{
+    if (str == nullptr)
+    {
+        return;
+    }
+    screenText(DD_EXPLICIT_CONTEXT_ONLY(ctx,) str, stringLength(str), pos, color, scaling, durationMillis);
+}
+
+void screenText(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const char * const str, const int length, ddVec3_In pos,
+                ddVec3_In color, const float scaling, const int durationMillis)
 {
     if (!isInitialized(DD_EXPLICIT_CONTEXT_ONLY(ctx)))
     {
         return;
     }
 
-    if (DD_CONTEXT->glyphTexHandle == nullptr)
+    if (DD_CONTEXT->glyphTexHandle == nullptr || str == nullptr || length < 0)
     {
         return;
     }
 
-    if (DD_CONTEXT->debugStringsCount == DEBUG_DRAW_MAX_STRINGS)
+    DebugString * dstr = pushDebugString(DD_EXPLICIT_CONTEXT_ONLY(ctx,) str, length, durationMillis);
+    if (dstr == nullptr)
     {
-        DEBUG_DRAW_OVERFLOWED("DEBUG_DRAW_MAX_STRINGS limit reached! Dropping further debug string draws.");
         return;
     }
 
-    DebugString & dstr    = DD_CONTEXT->debugStrings[DD_CONTEXT->debugStringsCount++];
-    dstr.expiryDateMillis = DD_CONTEXT->currentTimeMillis + durationMillis;
-    dstr.posX             = pos[X];
-    dstr.posY             = pos[Y];
-    dstr.scaling          = scaling;
-    dstr.text             = str;
-    dstr.centered         = false;
-    vecCopy(dstr.color, color);
+    dstr->posX     = pos[X];
+    dstr->posY     = pos[Y];
+    dstr->scaling  = scaling;
+    dstr->centered = false;
+    vecCopy(dstr->color, color);
 }
 
 void projectedText(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const char * const str, ddVec3_In pos, ddVec3_In color,
                    ddMat4x4_In vpMatrix, const int sx, const int sy, const int sw, const int sh, const float scaling,
                    const int durationMillis)
 {
-    if (!isInitialized(DD_EXPLICIT_CONTEXT_ONLY(ctx)))
+    if (str == nullptr)
     {
         return;
     }
+    projectedText(DD_EXPLICIT_CONTEXT_ONLY(ctx,) str, stringLength(str), pos, color,
+                  vpMatrix, sx, sy, sw, sh, scaling, durationMillis);
+}
 
-    if (DD_CONTEXT->glyphTexHandle == nullptr)
+void projectedText(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const char * const str, const int length, ddVec3_In pos,
+                   ddVec3_In color, ddMat4x4_In vpMatrix, const int sx, const int sy, const int sw, const int sh,
+                   const float scaling, const int durationMillis)
+{
+    if (!isInitialized(DD_EXPLICIT_CONTEXT_ONLY(ctx)))
     {
         return;
     }
 
-    if (DD_CONTEXT->debugStringsCount == DEBUG_DRAW_MAX_STRINGS)
+    if (DD_CONTEXT->glyphTexHandle == nullptr || str == nullptr || length < 0)
     {
-        DEBUG_DRAW_OVERFLOWED("DEBUG_DRAW_MAX_STRINGS limit reached! Dropping further debug string draws.");
         return;
     }
 
@@ -2772,14 +7280,17 @@ void projectedText(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const char * con
     // NOTE: This is not renderer agnostic, I think... Should add a #define or something!
     scrY = static_cast<float>(sh) - scrY;
 
-    DebugString & dstr    = DD_CONTEXT->debugStrings[DD_CONTEXT->debugStringsCount++];
-    dstr.expiryDateMillis = DD_CONTEXT->currentTimeMillis + durationMillis;
-    dstr.posX             = scrX;
-    dstr.posY             = scrY;
-    dstr.scaling          = scaling;
-    dstr.text             = str;
-    dstr.centered         = true;
-    vecCopy(dstr.color, color);
+    DebugString * dstr = pushDebugString(DD_EXPLICIT_CONTEXT_ONLY(ctx,) str, length, durationMillis);
+    if (dstr == nullptr)
+    {
+        return;
+    }
+
+    dstr->posX     = scrX;
+    dstr->posY     = scrY;
+    dstr->scaling  = scaling;
+    dstr->centered = true;
+    vecCopy(dstr->color, color);
 }
 
 void axisTriad(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) ddMat4x4_In transform, const float size,
@@ -2821,20 +7332,6 @@ void arrow(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) ddVec3_In from, ddVec3_I
         return;
     }
 
-    static const float arrowStep = 30.0f; // In degrees
-    static const float arrowSin[45] = {
-        0.0f, 0.5f, 0.866025f, 1.0f, 0.866025f, 0.5f, -0.0f, -0.5f, -0.866025f,
-        -1.0f, -0.866025f, -0.5f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f,
-        0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f,
-        0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f
-    };
-    static const float arrowCos[45] = {
-        1.0f, 0.866025f, 0.5f, -0.0f, -0.5f, -0.866026f, -1.0f, -0.866025f, -0.5f, 0.0f,
-        0.5f, 0.866026f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f,
-        0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f,
-        0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f
-    };
-
     // Body line:
     line(DD_EXPLICIT_CONTEXT_ONLY(ctx,) from, to, color, durationMillis, depthEnabled);
 
@@ -2843,36 +7340,12 @@ void arrow(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) ddVec3_In from, ddVec3_I
     vecSub(forward, to, from);
     vecNormalize(forward, forward);
     vecOrthogonalBasis(right, up, forward);
-    vecScale(forward, forward, size);
-
-    // Arrowhead is a cone (sin/cos tables used here):
-    float degrees = 0.0f;
-    for (int i = 0; degrees < 360.0f; degrees += arrowStep, ++i)
-    {
-        float scale;
-        ddVec3 v1, v2, temp;
-
-        scale = 0.5f * size * arrowCos[i];
-        vecScale(temp, right, scale);
-        vecSub(v1, to, forward);
-        vecAdd(v1, v1, temp);
-
-        scale = 0.5f * size * arrowSin[i];
-        vecScale(temp, up, scale);
-        vecAdd(v1, v1, temp);
-
-        scale = 0.5f * size * arrowCos[i + 1];
-        vecScale(temp, right, scale);
-        vecSub(v2, to, forward);
-        vecAdd(v2, v2, temp);
-
-        scale = 0.5f * size * arrowSin[i + 1];
-        vecScale(temp, up, scale);
-        vecAdd(v2, v2, temp);
 
-        line(DD_EXPLICIT_CONTEXT_ONLY(ctx,) v1, to, color, durationMillis, depthEnabled);
-        line(DD_EXPLICIT_CONTEXT_ONLY(ctx,) v1, v2, color, durationMillis, depthEnabled);
-    }
+    // Arrowhead is a cone pointing back from 'to':
+    vecScale(forward, forward, -size);
+    vecScale(right, right, 0.5f * size);
+    vecScale(up, up, 0.5f * size);
+    pushShapeInstance(DD_EXPLICIT_CONTEXT_ONLY(ctx,) ShapeArrowHead, right, up, forward, to, color, durationMillis, depthEnabled);
 }
 
 void cross(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) ddVec3_In center, const float length,
@@ -2920,28 +7393,22 @@ void circle(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) ddVec3_In center, ddVec
     }
 
     ddVec3 left, up;
-    ddVec3 point, lastPoint;
 
     vecOrthogonalBasis(left, up, planeNormal);
 
     vecScale(up, up, radius);
     vecScale(left, left, radius);
-    vecAdd(lastPoint, center, up);
 
-    for (int i = 1; i <= numSteps; ++i)
+    if (numSteps == static_cast<float>(ShapeCircleSteps))
     {
-        const float radians = TAU * i / numSteps;
-
-        ddVec3 vs, vc;
-        vecScale(vs, left, floatSin(radians));
-        vecScale(vc, up,   floatCos(radians));
-
-        vecAdd(point, center, vs);
-        vecAdd(point, point,  vc);
-
-        line(DD_EXPLICIT_CONTEXT_ONLY(ctx,) lastPoint, point, color, durationMillis, depthEnabled);
-        vecCopy(lastPoint, point);
+        ddVec3 normal;
+        vecScale(normal, planeNormal, radius);
+        pushShapeInstance(DD_EXPLICIT_CONTEXT_ONLY(ctx,) ShapeCircle, left, up, normal, center, color, durationMillis, depthEnabled);
+        return;
     }
+
+    QueueLineSink sink(DD_EXPLICIT_CONTEXT_ONLY(ctx,) color, durationMillis, depthEnabled);
+    circleLines(sink, center, left, up, numSteps);
 }
 
 void plane(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) ddVec3_In center, ddVec3_In planeNormal, ddVec3_In planeColor,
@@ -2993,41 +7460,18 @@ void sphere(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) ddVec3_In center, ddVec
         return;
     }
 
-    static const int stepSize = 15;
-    ddVec3 cache[360 / stepSize];
-    ddVec3 radiusVec;
-
-    vecSet(radiusVec, 0.0f, 0.0f, radius);
-    vecAdd(cache[0], center, radiusVec);
-
-    for (int n = 1; n < arrayLength(cache); ++n)
+    if (isSubmissionCullable(DD_EXPLICIT_CONTEXT_ONLY(ctx,) durationMillis) &&
+        isSphereCulled(DD_EXPLICIT_CONTEXT_ONLY(ctx,) center, radius))
     {
-        vecCopy(cache[n], cache[0]);
+        ++DD_CONTEXT->cullStats.spheres;
+        return;
     }
 
-    ddVec3 lastPoint, temp;
-    for (int i = stepSize; i <= 360; i += stepSize)
-    {
-        const float s = floatSin(degreesToRadians(i));
-        const float c = floatCos(degreesToRadians(i));
-
-        lastPoint[X] = center[X];
-        lastPoint[Y] = center[Y] + radius * s;
-        lastPoint[Z] = center[Z] + radius * c;
-
-        for (int n = 0, j = stepSize; j <= 360; j += stepSize, ++n)
-        {
-            temp[X] = center[X] + floatSin(degreesToRadians(j)) * radius * s;
-            temp[Y] = center[Y] + floatCos(degreesToRadians(j)) * radius * s;
-            temp[Z] = lastPoint[Z];
-
-            line(DD_EXPLICIT_CONTEXT_ONLY(ctx,) lastPoint, temp, color, durationMillis, depthEnabled);
-            line(DD_EXPLICIT_CONTEXT_ONLY(ctx,) lastPoint, cache[n], color, durationMillis, depthEnabled);
-
-            vecCopy(cache[n], lastPoint);
-            vecCopy(lastPoint, temp);
-        }
-    }
+    ddVec3 xAxis, yAxis, zAxis;
+    vecSet(xAxis, radius, 0.0f, 0.0f);
+    vecSet(yAxis, 0.0f, radius, 0.0f);
+    vecSet(zAxis, 0.0f, 0.0f, radius);
+    pushShapeInstance(DD_EXPLICIT_CONTEXT_ONLY(ctx,) ShapeSphere, xAxis, yAxis, zAxis, center, color, durationMillis, depthEnabled);
 }
 
 void cone(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) ddVec3_In apex, ddVec3_In dir, ddVec3_In color,
@@ -3038,10 +7482,8 @@ void cone(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) ddVec3_In apex, ddVec3_In
         return;
     }
 
-    static const int stepSize = 20;
     ddVec3 axis[3];
-    ddVec3 top, temp0, temp1, temp2;
-    ddVec3 p1, p2, lastP1, lastP2;
+    ddVec3 top;
 
     vecCopy(axis[2], dir);
     vecNormalize(axis[2], axis[2]);
@@ -3051,57 +7493,50 @@ void cone(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) ddVec3_In apex, ddVec3_In
     axis[1][Y] = -axis[1][Y];
     axis[1][Z] = -axis[1][Z];
 
-    vecAdd(top, apex, dir);
-    vecScale(temp1, axis[1], baseRadius);
-    vecAdd(lastP2, top, temp1);
-
-    if (apexRadius == 0.0f)
+    if (isSubmissionCullable(DD_EXPLICIT_CONTEXT_ONLY(ctx,) durationMillis))
     {
-        for (int i = stepSize; i <= 360; i += stepSize)
+        // Box around the cone, with its wider end.
+        const float maxRadius = (baseRadius > apexRadius) ? baseRadius : apexRadius;
+        ddVec3 center, xHalf, yHalf, zHalf;
+        vecScale(xHalf, axis[0], maxRadius);
+        vecScale(yHalf, axis[1], maxRadius);
+        vecScale(zHalf, dir, 0.5f);
+        vecAdd(center, apex, zHalf);
+        if (isBoxCulled(DD_EXPLICIT_CONTEXT_ONLY(ctx,) center, xHalf, yHalf, zHalf))
         {
-            vecScale(temp1, axis[0], floatSin(degreesToRadians(i)));
-            vecScale(temp2, axis[1], floatCos(degreesToRadians(i)));
-            vecAdd(temp0, temp1, temp2);
-
-            vecScale(temp0, temp0, baseRadius);
-            vecAdd(p2, top, temp0);
-
-            line(DD_EXPLICIT_CONTEXT_ONLY(ctx,) lastP2, p2, color, durationMillis, depthEnabled);
-            line(DD_EXPLICIT_CONTEXT_ONLY(ctx,) p2, apex, color, durationMillis, depthEnabled);
-
-            vecCopy(lastP2, p2);
+            ++DD_CONTEXT->cullStats.cones;
+            return;
         }
     }
-    else // A degenerate cone with open apex:
-    {
-        vecScale(temp1, axis[1], apexRadius);
-        vecAdd(lastP1, apex, temp1);
-
-        for (int i = stepSize; i <= 360; i += stepSize)
-        {
-            vecScale(temp1, axis[0], floatSin(degreesToRadians(i)));
-            vecScale(temp2, axis[1], floatCos(degreesToRadians(i)));
-            vecAdd(temp0, temp1, temp2);
-
-            vecScale(temp1, temp0, apexRadius);
-            vecScale(temp2, temp0, baseRadius);
-
-            vecAdd(p1, apex, temp1);
-            vecAdd(p2, top,  temp2);
 
-            line(DD_EXPLICIT_CONTEXT_ONLY(ctx,) lastP1, p1, color, durationMillis, depthEnabled);
-            line(DD_EXPLICIT_CONTEXT_ONLY(ctx,) lastP2, p2, color, durationMillis, depthEnabled);
-            line(DD_EXPLICIT_CONTEXT_ONLY(ctx,) p1, p2, color, durationMillis, depthEnabled);
-
-            vecCopy(lastP1, p1);
-            vecCopy(lastP2, p2);
-        }
+    if (apexRadius == 0.0f)
+    {
+        vecScale(axis[0], axis[0], baseRadius);
+        vecScale(axis[1], axis[1], baseRadius);
+        pushShapeInstance(DD_EXPLICIT_CONTEXT_ONLY(ctx,) ShapeCone, axis[0], axis[1], dir, apex, color, durationMillis, depthEnabled);
+        return;
     }
+
+    vecAdd(top, apex, dir);
+    QueueLineSink sink(DD_EXPLICIT_CONTEXT_ONLY(ctx,) color, durationMillis, depthEnabled);
+    coneLines(sink, apex, top, axis[0], axis[1], baseRadius, apexRadius, unitCircle20Deg, 18);
 }
 
 void box(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) const ddVec3 points[8], ddVec3_In color,
          const int durationMillis, const bool depthEnabled)
 {
+    if (!isInitialized(DD_EXPLICIT_CONTEXT_ONLY(ctx)))
+    {
+        return;
+    }
+
+    if (isSubmissionCullable(DD_EXPLICIT_CONTEXT_ONLY(ctx,) durationMillis) &&
+        arePointsCulled(DD_EXPLICIT_CONTEXT_ONLY(ctx,) points, 8))
+    {
+        ++DD_CONTEXT->cullStats.boxes;
+        return;
+    }
+
     // Build the lines from points using clever indexing tricks:
     // (& 3 is a fancy way of doing % 4, but avoids the expensive modulo operation)
     for (int i = 0; i < 4; ++i)
@@ -3120,30 +7555,18 @@ void box(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) ddVec3_In center, ddVec3_I
         return;
     }
 
-    const float cx = center[X];
-    const float cy = center[Y];
-    const float cz = center[Z];
-    const float w  = width  * 0.5f;
-    const float h  = height * 0.5f;
-    const float d  = depth  * 0.5f;
-
-    // Create all the 8 points:
-    ddVec3 points[8];
-    #define DD_BOX_V(v, op1, op2, op3) \
-    v[X] = cx op1 w; \
-    v[Y] = cy op2 h; \
-    v[Z] = cz op3 d
-    DD_BOX_V(points[0], -, +, +);
-    DD_BOX_V(points[1], -, +, -);
-    DD_BOX_V(points[2], +, +, -);
-    DD_BOX_V(points[3], +, +, +);
-    DD_BOX_V(points[4], -, -, +);
-    DD_BOX_V(points[5], -, -, -);
-    DD_BOX_V(points[6], +, -, -);
-    DD_BOX_V(points[7], +, -, +);
-    #undef DD_BOX_V
+    ddVec3 xAxis, yAxis, zAxis;
+    vecSet(xAxis, width * 0.5f, 0.0f, 0.0f);
+    vecSet(yAxis, 0.0f, height * 0.5f, 0.0f);
+    vecSet(zAxis, 0.0f, 0.0f, depth * 0.5f);
 
-    box(DD_EXPLICIT_CONTEXT_ONLY(ctx,) points, color, durationMillis, depthEnabled);
+    if (isSubmissionCullable(DD_EXPLICIT_CONTEXT_ONLY(ctx,) durationMillis) &&
+        isBoxCulled(DD_EXPLICIT_CONTEXT_ONLY(ctx,) center, xAxis, yAxis, zAxis))
+    {
+        ++DD_CONTEXT->cullStats.boxes;
+        return;
+    }
+    pushShapeInstance(DD_EXPLICIT_CONTEXT_ONLY(ctx,) ShapeBox, xAxis, yAxis, zAxis, center, color, durationMillis, depthEnabled);
 }
 
 void aabb(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) ddVec3_In mins, ddVec3_In maxs,
@@ -3154,22 +7577,19 @@ void aabb(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) ddVec3_In mins, ddVec3_In
         return;
     }
 
-    ddVec3 bb[2];
-    ddVec3 points[8];
-
-    vecCopy(bb[0], mins);
-    vecCopy(bb[1], maxs);
+    ddVec3 center, xAxis, yAxis, zAxis;
+    vecSet(center, (mins[X] + maxs[X]) * 0.5f, (mins[Y] + maxs[Y]) * 0.5f, (mins[Z] + maxs[Z]) * 0.5f);
+    vecSet(xAxis, (maxs[X] - mins[X]) * 0.5f, 0.0f, 0.0f);
+    vecSet(yAxis, 0.0f, (maxs[Y] - mins[Y]) * 0.5f, 0.0f);
+    vecSet(zAxis, 0.0f, 0.0f, (maxs[Z] - mins[Z]) * 0.5f);
 
-    // Expand min/max bounds:
-    for (int i = 0; i < arrayLength(points); ++i)
+    if (isSubmissionCullable(DD_EXPLICIT_CONTEXT_ONLY(ctx,) durationMillis) &&
+        isBoxCulled(DD_EXPLICIT_CONTEXT_ONLY(ctx,) center, xAxis, yAxis, zAxis))
     {
-        points[i][X] = bb[(i ^ (i >> 1)) & 1][X];
-        points[i][Y] = bb[(i >> 1) & 1][Y];
-        points[i][Z] = bb[(i >> 2) & 1][Z];
+        ++DD_CONTEXT->cullStats.aabbs;
+        return;
     }
-
-    // Build the lines:
-    box(DD_EXPLICIT_CONTEXT_ONLY(ctx,) points, color, durationMillis, depthEnabled);
+    pushShapeInstance(DD_EXPLICIT_CONTEXT_ONLY(ctx,) ShapeBox, xAxis, yAxis, zAxis, center, color, durationMillis, depthEnabled);
 }
 
 void frustum(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) ddMat4x4_In invClipMatrix,
@@ -3213,6 +7633,13 @@ void frustum(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) ddMat4x4_In invClipMat
         points[i][Z] /= wCoords[i];
     }
 
+    if (isSubmissionCullable(DD_EXPLICIT_CONTEXT_ONLY(ctx,) durationMillis) &&
+        arePointsCulled(DD_EXPLICIT_CONTEXT_ONLY(ctx,) points, 8))
+    {
+        ++DD_CONTEXT->cullStats.frustums;
+        return;
+    }
+
     // Connect the dots:
     box(DD_EXPLICIT_CONTEXT_ONLY(ctx,) points, color, durationMillis, depthEnabled);
 }
@@ -3301,13 +7728,12 @@ void capsule(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) ddVec3_In center, ddVe
     }
 
     // Normalize the axis vector
-    float magnitude = sqrt(axis[X] * axis[X] + axis[Y] * axis[Y] + axis[Z] * axis[Z]);
-    if (magnitude == 0.0f)
+    if (axis[X] == 0.0f && axis[Y] == 0.0f && axis[Z] == 0.0f)
     {
         return; // Invalid axis, exit gracefully
     }
     ddVec3 dir;
-    vecScale(dir, axis, 1.0f / magnitude);
+    vecNormalize(dir, axis);
 
     // Compute endpoints (centers of the hemispheres)
     ddVec3 temp;
@@ -3319,11 +7745,11 @@ void capsule(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) ddVec3_In center, ddVe
     // Find vectors u and v perpendicular to dir for the cross-section plane
     ddVec3 u, v, tempVec;
     // Choose a vector not parallel to dir
-    if (fabs(dir[X]) <= fabs(dir[Y]) && fabs(dir[X]) <= fabs(dir[Z]))
+    if (floatAbs(dir[X]) <= floatAbs(dir[Y]) && floatAbs(dir[X]) <= floatAbs(dir[Z]))
     {
         vecSet(tempVec, 1.0f, 0.0f, 0.0f);
     }
-    else if (fabs(dir[Y]) <= fabs(dir[Z]))
+    else if (floatAbs(dir[Y]) <= floatAbs(dir[Z]))
     {
         vecSet(tempVec, 0.0f, 1.0f, 0.0f);
     }
@@ -3332,131 +7758,85 @@ void capsule(DD_EXPLICIT_CONTEXT_ONLY(ContextHandle ctx,) ddVec3_In center, ddVe
         vecSet(tempVec, 0.0f, 0.0f, 1.0f);
     }
     vecCross(u, tempVec, dir);
-    float uMag = sqrt(u[X] * u[X] + u[Y] * u[Y] + u[Z] * u[Z]);
-    vecScale(u, u, 1.0f / uMag);
+    vecNormalize(u, u);
     vecCross(v, dir, u); // v is already unit length since dir and u are orthonormal
 
-    static const int stepSize = 15;
-
-    // Draw the cylinder
-    for (int j = 0; j < 360; j += stepSize)
-    {
-        float theta = degreesToRadians((float)j);
-        float theta2 = degreesToRadians((float)(j + stepSize));
-        ddVec3 point1, point2, point3, point4;
-
-        float c = floatCos(theta);
-        float s = floatSin(theta);
-        float c2 = floatCos(theta2);
-        float s2 = floatSin(theta2);
-
-        // Circle at p1
-        vecSet(point1, p1[X] + radius * (c * u[X] + s * v[X]),
-            p1[Y] + radius * (c * u[Y] + s * v[Y]),
-            p1[Z] + radius * (c * u[Z] + s * v[Z]));
-        vecSet(point2, p1[X] + radius * (c2 * u[X] + s2 * v[X]),
-            p1[Y] + radius * (c2 * u[Y] + s2 * v[Y]),
-            p1[Z] + radius * (c2 * u[Z] + s2 * v[Z]));
-        line(DD_EXPLICIT_CONTEXT_ONLY(ctx,) point1, point2, color, durationMillis, depthEnabled);
-
-        // Circle at p2
-        vecSet(point3, p2[X] + radius * (c * u[X] + s * v[X]),
-            p2[Y] + radius * (c * u[Y] + s * v[Y]),
-            p2[Z] + radius * (c * u[Z] + s * v[Z]));
-        vecSet(point4, p2[X] + radius * (c2 * u[X] + s2 * v[X]),
-            p2[Y] + radius * (c2 * u[Y] + s2 * v[Y]),
-            p2[Z] + radius * (c2 * u[Z] + s2 * v[Z]));
-        line(DD_EXPLICIT_CONTEXT_ONLY(ctx,) point3, point4, color, durationMillis, depthEnabled);
-
-        // Connecting line between circles
-        line(DD_EXPLICIT_CONTEXT_ONLY(ctx,) point1, point3, color, durationMillis, depthEnabled);
-    }
+    // The body, then the hemispheres at p1 and p2.
+    ddVec3 ur, vr, axisVec, d1, d2;
+    vecScale(ur, u, radius);
+    vecScale(vr, v, radius);
+    vecSub(axisVec, p2, p1);
+    vecScale(d1, dir, -radius);
+    vecScale(d2, dir, radius);
 
-    // Draw hemisphere at p1 (dome along -dir)
-    ddVec3 d1;
-    vecScale(d1, dir, -1.0f); // Direction for p1 hemisphere
-    for (int i = 0; i <= 90; i += stepSize)
+    if (isSubmissionCullable(DD_EXPLICIT_CONTEXT_ONLY(ctx,) durationMillis))
     {
-        float phi = degreesToRadians((float)i);
-        float s = floatSin(phi);
-        float c = floatCos(phi);
-
-        for (int j = 0; j < 360; j += stepSize)
+        ddVec3 zHalf;
+        vecScale(zHalf, dir, length * 0.5f + radius);
+        if (isBoxCulled(DD_EXPLICIT_CONTEXT_ONLY(ctx,) center, ur, vr, zHalf))
         {
-            float theta = degreesToRadians((float)j);
-            float theta2 = degreesToRadians((float)(j + stepSize));
-            ddVec3 point1, point2;
-
-            vecSet(point1, p1[X] + radius * (s * floatCos(theta) * u[X] + s * floatSin(theta) * v[X] + c * d1[X]),
-                p1[Y] + radius * (s * floatCos(theta) * u[Y] + s * floatSin(theta) * v[Y] + c * d1[Y]),
-                p1[Z] + radius * (s * floatCos(theta) * u[Z] + s * floatSin(theta) * v[Z] + c * d1[Z]));
-            vecSet(point2, p1[X] + radius * (s * floatCos(theta2) * u[X] + s * floatSin(theta2) * v[X] + c * d1[X]),
-                p1[Y] + radius * (s * floatCos(theta2) * u[Y] + s * floatSin(theta2) * v[Y] + c * d1[Y]),
-                p1[Z] + radius * (s * floatCos(theta2) * u[Z] + s * floatSin(theta2) * v[Z] + c * d1[Z]));
-            line(DD_EXPLICIT_CONTEXT_ONLY(ctx,) point1, point2, color, durationMillis, depthEnabled);
-
-            if (i < 90)
-            {
-                float phi2 = degreesToRadians((float)(i + stepSize));
-                float s2 = floatSin(phi2);
-                float c2 = floatCos(phi2);
-                ddVec3 point3;
-                vecSet(point3, p1[X] + radius * (s2 * floatCos(theta) * u[X] + s2 * floatSin(theta) * v[X] + c2 * d1[X]),
-                    p1[Y] + radius * (s2 * floatCos(theta) * u[Y] + s2 * floatSin(theta) * v[Y] + c2 * d1[Y]),
-                    p1[Z] + radius * (s2 * floatCos(theta) * u[Z] + s2 * floatSin(theta) * v[Z] + c2 * d1[Z]));
-                line(DD_EXPLICIT_CONTEXT_ONLY(ctx,) point1, point3, color, durationMillis, depthEnabled);
-            }
+            ++DD_CONTEXT->cullStats.capsules;
+            return;
         }
     }
+    pushShapeInstance(DD_EXPLICIT_CONTEXT_ONLY(ctx,) ShapeCapsuleBody, ur, vr, axisVec, p1, color, durationMillis, depthEnabled);
+    pushShapeInstance(DD_EXPLICIT_CONTEXT_ONLY(ctx,) ShapeCapsuleCap,  ur, vr, d1,      p1, color, durationMillis, depthEnabled);
+    pushShapeInstance(DD_EXPLICIT_CONTEXT_ONLY(ctx,) ShapeCapsuleCap,  ur, vr, d2,      p2, color, durationMillis, depthEnabled);
+}
 
-    // Draw hemisphere at p2 (dome along +dir)
-    for (int i = 0; i <= 90; i += stepSize)
-    {
-        float phi = degreesToRadians((float)i);
-        float s = floatSin(phi);
-        float c = floatCos(phi);
+// ========================================================
+// RenderInterface stubs:
+// ========================================================
 
-        for (int j = 0; j < 360; j += stepSize)
-        {
-            float theta = degreesToRadians((float)j);
-            float theta2 = degreesToRadians((float)(j + stepSize));
-            ddVec3 point1, point2;
+RenderInterface::~RenderInterface()                                                                        { }
+void RenderInterface::beginDraw()                                                                          { }
+void RenderInterface::endDraw()                                                                            { }
+void RenderInterface::beginLayer(int)                                                                      { }
+void RenderInterface::drawPointList(const DrawVertex *, int, bool)                                         { }
+void RenderInterface::drawLineList(const DrawVertex *, int, bool)                                          { }
+void RenderInterface::drawGlyphList(const DrawVertex *, int, GlyphTextureHandle)                           { }
+void RenderInterface::drawPackedPointList(const CompactVertex *, int, float, bool)                         { }
+void RenderInterface::drawPackedLineList(const CompactVertex *, int, bool)                                 { }
+VertexFormat RenderInterface::getVertexFormat()                                                            { return VertexFormatDefault; }
+IndexFormat RenderInterface::getIndexFormat()                                                              { return IndexFormatNone; }
+int RenderInterface::getPreferredBatchSize()                                                               { return 0; }
+int RenderInterface::getMaxBatchSize()                                                                     { return 0; }
+void RenderInterface::drawIndexedLineList(const DrawVertex *, int, const void *, int, bool)                { }
+void RenderInterface::drawPackedIndexedLineList(const CompactVertex *, int, const void *, int, bool)       { }
+void RenderInterface::drawIndexedGlyphList(const DrawVertex *, int, const void *, int, GlyphTextureHandle) { }
+void * RenderInterface::acquireVertices(PrimitiveType, int)                                                { return nullptr; }
+void RenderInterface::commitVertices(const VertexBatch &)                                                  { }
+bool RenderInterface::wantsFrameSubmission()                                                               { return false; }
+void RenderInterface::submitFrame(const FrameSubmission &)                                                 { }
+bool RenderInterface::wantsInstancedShapes()                                                               { return false; }
+void RenderInterface::createShapeMesh(ShapeId, const ShapeMesh &)                                          { }
+void RenderInterface::drawInstancedShapes(ShapeId, const ShapeInstance *, int, bool)                       { }
+void RenderInterface::destroyGlyphTexture(GlyphTextureHandle)                                              { }
+GlyphTextureHandle RenderInterface::createGlyphTexture(int, int, const void *)                             { return nullptr; }
 
-            vecSet(point1, p2[X] + radius * (s * floatCos(theta) * u[X] + s * floatSin(theta) * v[X] + c * dir[X]),
-                p2[Y] + radius * (s * floatCos(theta) * u[Y] + s * floatSin(theta) * v[Y] + c * dir[Y]),
-                p2[Z] + radius * (s * floatCos(theta) * u[Z] + s * floatSin(theta) * v[Z] + c * dir[Z]));
-            vecSet(point2, p2[X] + radius * (s * floatCos(theta2) * u[X] + s * floatSin(theta2) * v[X] + c * dir[X]),
-                p2[Y] + radius * (s * floatCos(theta2) * u[Y] + s * floatSin(theta2) * v[Y] + c * dir[Y]),
-                p2[Z] + radius * (s * floatCos(theta2) * u[Z] + s * floatSin(theta2) * v[Z] + c * dir[Z]));
-            line(DD_EXPLICIT_CONTEXT_ONLY(ctx,) point1, point2, color, durationMillis, depthEnabled);
+// ========================================================
+// Allocator defaults:
+// ========================================================
 
-            if (i < 90)
-            {
-                float phi2 = degreesToRadians((float)(i + stepSize));
-                float s2 = floatSin(phi2);
-                float c2 = floatCos(phi2);
-                ddVec3 point3;
-                vecSet(point3, p2[X] + radius * (s2 * floatCos(theta) * u[X] + s2 * floatSin(theta) * v[X] + c2 * dir[X]),
-                    p2[Y] + radius * (s2 * floatCos(theta) * u[Y] + s2 * floatSin(theta) * v[Y] + c2 * dir[Y]),
-                    p2[Z] + radius * (s2 * floatCos(theta) * u[Z] + s2 * floatSin(theta) * v[Z] + c2 * dir[Z]));
-                line(DD_EXPLICIT_CONTEXT_ONLY(ctx,) point1, point3, color, durationMillis, depthEnabled);
-            }
-        }
-    }
-}
+Allocator::~Allocator()                                                                                    { }
+void * Allocator::allocate(std::size_t sizeBytes, std::size_t, AllocTag)                                   { return DD_MALLOC(sizeBytes); }
+void Allocator::deallocate(void * ptr, std::size_t, AllocTag)                                              { DD_MFREE(ptr); }
 
 // ========================================================
-// RenderInterface stubs:
+// TaskScheduler defaults:
 // ========================================================
 
-RenderInterface::~RenderInterface()                                              { }
-void RenderInterface::beginDraw()                                                { }
-void RenderInterface::endDraw()                                                  { }
-void RenderInterface::drawPointList(const DrawVertex *, int, bool)               { }
-void RenderInterface::drawLineList(const DrawVertex *, int, bool)                { }
-void RenderInterface::drawGlyphList(const DrawVertex *, int, GlyphTextureHandle) { }
-void RenderInterface::destroyGlyphTexture(GlyphTextureHandle)                    { }
-GlyphTextureHandle RenderInterface::createGlyphTexture(int, int, const void *)   { return nullptr; }
+TaskScheduler::~TaskScheduler()
+{
+}
+
+void TaskScheduler::parallelFor(const int count, TaskFunc task, void * userData)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        task(userData, i);
+    }
+}
 
 } // namespace dd
 
@@ -0,0 +1,99 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File:   bench_shapes.cpp
+// Brief:  Microbenchmark of how many tessellated shapes per second Debug Draw can queue and flush.
+//
+// Uses a null renderer, so only the library side is timed: queuing the shapes and
+// expanding them into lines in dd::flush().
+// The 'bench' target in the Makefile builds this with and without DEBUG_DRAW_USE_STD_MATH.
+//
+// This software is in the public domain. Where that dedication is not recognized,
+// you are granted a perpetual, irrevocable license to copy, distribute, and modify
+// this file as you see fit.
+// ================================================================================================
+
+#define DEBUG_DRAW_IMPLEMENTATION
+#include "debug_draw.hpp"
+
+#include <chrono>
+#include <cstdio>
+
+class DDRenderInterfaceNull final
+    : public dd::RenderInterface
+{
+};
+
+static const int NumShapes = 200;
+static const int NumFrames = 40;
+
+template<typename ShapeFunc>
+static double measureShapesPerSecond(ShapeFunc drawShape)
+{
+    double bestSeconds = 1e9;
+    for (int frame = 0; frame < NumFrames; ++frame)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < NumShapes; ++i)
+        {
+            drawShape(static_cast<float>(i));
+        }
+        dd::flush();
+        const auto end = std::chrono::steady_clock::now();
+
+        const double seconds = std::chrono::duration<double>(end - start).count();
+        if (seconds < bestSeconds)
+        {
+            bestSeconds = seconds;
+        }
+    }
+    return NumShapes / bestSeconds;
+}
+
+int main()
+{
+    DDRenderInterfaceNull renderIface;
+
+    // Room for NumShapes capsules (3 shapes each) and open apex cones (54 lines each),
+    // the circles with 32 steps are lines too.
+    dd::ContextConfig config;
+    config.maxShapes = NumShapes * 3;
+    config.maxLines  = NumShapes * 54;
+    if (!dd::initialize(&renderIface, config))
+    {
+        std::fprintf(stderr, "Failed to initialize Debug Draw!\n");
+        return 1;
+    }
+
+    const ddVec3 color = { 0.2f, 0.7f, 0.3f };
+    const ddVec3 axis  = { 0.3f, 1.0f, 0.2f };
+
+    const double spheres = measureShapesPerSecond([&](const float f)
+    {
+        const ddVec3 center = { f, f * 0.5f, -f };
+        dd::sphere(center, color, 2.5f);
+    });
+
+    const double cones = measureShapesPerSecond([&](const float f)
+    {
+        const ddVec3 apex = { f, f * 0.5f, -f };
+        dd::cone(apex, axis, color, 1.0f, 0.5f);
+    });
+
+    const double circles = measureShapesPerSecond([&](const float f)
+    {
+        const ddVec3 center = { f, f * 0.5f, -f };
+        dd::circle(center, axis, color, 3.0f, 32.0f);
+    });
+
+    const double capsules = measureShapesPerSecond([&](const float f)
+    {
+        const ddVec3 center = { f, f * 0.5f, -f };
+        dd::capsule(center, axis, 3.0f, 1.0f, color);
+    });
+
+    std::printf("%-9s sphere: %8.0f/s   cone: %8.0f/s   circle: %8.0f/s   capsule: %8.0f/s\n",
+                DEBUG_DRAW_USE_STD_MATH ? "std math" : "fast math", spheres, cones, circles, capsules);
+
+    dd::shutdown();
+}
@@ -0,0 +1,110 @@
+
+// ================================================================================================
+// -*- C++ -*-
+// File:   bench_vertex_expansion.cpp
+// Brief:  Microbenchmark of the speed Debug Draw expands queued points and lines into vertexes.
+//
+// Uses a null renderer, so only the library side of dd::flush() is measured.
+// The kernel is chosen at compile time; see the 'bench' target in the Makefile,
+// which builds this once per kernel.
+//
+// This software is in the public domain. Where that dedication is not recognized,
+// you are granted a perpetual, irrevocable license to copy, distribute, and modify
+// this file as you see fit.
+// ================================================================================================
+
+#define DEBUG_DRAW_IMPLEMENTATION
+#include "debug_draw.hpp"
+
+#include <chrono>
+#include <cstdio>
+
+#if defined(DEBUG_DRAW_NO_SIMD)
+    static const char * const kernelName = "scalar";
+#elif defined(__AVX2__)
+    static const char * const kernelName = "avx2";
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    static const char * const kernelName = "sse2";
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    static const char * const kernelName = "neon";
+#else
+    static const char * const kernelName = "scalar";
+#endif
+
+class DDRenderInterfaceNull final
+    : public dd::RenderInterface
+{
+public:
+    int vertexCount = 0;
+
+    void drawPointList(const dd::DrawVertex *, int count, bool) override { vertexCount += count; }
+    void drawLineList(const dd::DrawVertex *, int count, bool) override  { vertexCount += count; }
+};
+
+static const int NumElements = 250000;
+static const int NumFrames   = 40;
+
+template<typename QueueFunc>
+static double measureVertsPerSecond(DDRenderInterfaceNull & renderIface, QueueFunc queueElements)
+{
+    double bestSeconds = 1e9;
+    for (int frame = 0; frame < NumFrames; ++frame)
+    {
+        queueElements();
+        renderIface.vertexCount = 0;
+
+        const auto start = std::chrono::steady_clock::now();
+        dd::flush();
+        const auto end = std::chrono::steady_clock::now();
+
+        const double seconds = std::chrono::duration<double>(end - start).count();
+        if (seconds < bestSeconds)
+        {
+            bestSeconds = seconds;
+        }
+    }
+    return renderIface.vertexCount / bestSeconds;
+}
+
+int main()
+{
+    DDRenderInterfaceNull renderIface;
+
+    dd::ContextConfig config;
+    config.maxLines  = NumElements;
+    config.maxPoints = NumElements;
+    config.vertexBufferSize = 16384;
+    if (!dd::initialize(&renderIface, config))
+    {
+        std::fprintf(stderr, "Failed to initialize Debug Draw!\n");
+        return 1;
+    }
+
+    const double lineVertsPerSec = measureVertsPerSecond(renderIface, []()
+    {
+        for (int i = 0; i < NumElements; ++i)
+        {
+            const float f = static_cast<float>(i);
+            const ddVec3 from  = { f, f * 0.5f, -f };
+            const ddVec3 to    = { -f, f, f * 0.25f };
+            const ddVec3 color = { 0.2f, 0.7f, (i & 255) / 255.0f };
+            dd::line(from, to, color);
+        }
+    });
+
+    const double pointVertsPerSec = measureVertsPerSecond(renderIface, []()
+    {
+        for (int i = 0; i < NumElements; ++i)
+        {
+            const float f = static_cast<float>(i);
+            const ddVec3 pos   = { f, f * 0.5f, -f };
+            const ddVec3 color = { 0.9f, (i & 255) / 255.0f, 0.1f };
+            dd::point(pos, color, 4.0f);
+        }
+    });
+
+    std::printf("%-8s lines: %8.1f M verts/s   points: %8.1f M verts/s\n",
+                kernelName, lineVertsPerSec / 1e6, pointVertsPerSec / 1e6);
+
+    dd::shutdown();
+}
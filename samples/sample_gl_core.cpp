@@ -35,32 +35,11 @@ public:
         assert(points != nullptr);
         assert(count > 0 && count <= DEBUG_DRAW_VERTEX_BUFFER_SIZE);
 
-        glBindVertexArray(linePointVAO);
-        glUseProgram(linePointProgram);
-
-        glUniformMatrix4fv(linePointProgram_MvpMatrixLocation,
-                           1, GL_FALSE, toFloatPtr(mvpMatrix));
-
-        if (depthEnabled)
-        {
-            glEnable(GL_DEPTH_TEST);
-        }
-        else
-        {
-            glDisable(GL_DEPTH_TEST);
-        }
-
         // NOTE: Could also use glBufferData to take advantage of the buffer orphaning trick...
         glBindBuffer(GL_ARRAY_BUFFER, linePointVBO);
         glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(dd::DrawVertex), points);
 
-        // Issue the draw call:
-        glDrawArrays(GL_POINTS, 0, count);
-
-        glUseProgram(0);
-        glBindVertexArray(0);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        checkGLError(__FILE__, __LINE__);
+        drawLinePointBatch(GL_POINTS, count, depthEnabled);
     }
 
     void drawLineList(const dd::DrawVertex * lines, int count, bool depthEnabled) override
@@ -68,32 +47,11 @@ public:
         assert(lines != nullptr);
         assert(count > 0 && count <= DEBUG_DRAW_VERTEX_BUFFER_SIZE);
 
-        glBindVertexArray(linePointVAO);
-        glUseProgram(linePointProgram);
-
-        glUniformMatrix4fv(linePointProgram_MvpMatrixLocation,
-                           1, GL_FALSE, toFloatPtr(mvpMatrix));
-
-        if (depthEnabled)
-        {
-            glEnable(GL_DEPTH_TEST);
-        }
-        else
-        {
-            glDisable(GL_DEPTH_TEST);
-        }
-
         // NOTE: Could also use glBufferData to take advantage of the buffer orphaning trick...
         glBindBuffer(GL_ARRAY_BUFFER, linePointVBO);
         glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(dd::DrawVertex), lines);
 
-        // Issue the draw call:
-        glDrawArrays(GL_LINES, 0, count);
-
-        glUseProgram(0);
-        glBindVertexArray(0);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        checkGLError(__FILE__, __LINE__);
+        drawLinePointBatch(GL_LINES, count, depthEnabled);
     }
 
     void drawGlyphList(const dd::DrawVertex * glyphs, int count, dd::GlyphTextureHandle glyphTex) override
@@ -101,36 +59,58 @@ public:
         assert(glyphs != nullptr);
         assert(count > 0 && count <= DEBUG_DRAW_VERTEX_BUFFER_SIZE);
 
-        glBindVertexArray(textVAO);
-        glUseProgram(textProgram);
-
-        // These doesn't have to be reset every draw call, I'm just being lazy ;)
-        glUniform1i(textProgram_GlyphTextureLocation, 0);
-        glUniform2f(textProgram_ScreenDimensions,
-                    static_cast<GLfloat>(WindowWidth),
-                    static_cast<GLfloat>(WindowHeight));
+        glBindBuffer(GL_ARRAY_BUFFER, textVBO);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(dd::DrawVertex), glyphs);
 
-        if (glyphTex != nullptr)
-        {
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, handleToGL(glyphTex));
-        }
+        drawGlyphBatch(count, glyphTex);
+    }
 
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-        glDisable(GL_DEPTH_TEST);
+    // Our VBOs are allocated with room for DEBUG_DRAW_VERTEX_BUFFER_SIZE vertexes,
+    // so batches can't be any larger than that, whatever the context config says.
+    int getMaxBatchSize() override
+    {
+        return DEBUG_DRAW_VERTEX_BUFFER_SIZE;
+    }
 
-        glBindBuffer(GL_ARRAY_BUFFER, textVBO);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(dd::DrawVertex), glyphs);
+    //
+    // Zero-copy path: Debug Draw writes the vertexes straight into our mapped VBO,
+    // so the draw*List() methods above are only used if mapping fails.
+    //
+    void * acquireVertices(dd::PrimitiveType type, int maxCount) override
+    {
+        assert(maxCount > 0 && maxCount <= DEBUG_DRAW_VERTEX_BUFFER_SIZE);
 
-        glDrawArrays(GL_TRIANGLES, 0, count); // Issue the draw call
+        mappedVBO = (type == dd::PrimitiveGlyphs) ? textVBO : linePointVBO;
+        glBindBuffer(GL_ARRAY_BUFFER, mappedVBO);
 
-        glDisable(GL_BLEND);
-        glUseProgram(0);
-        glBindVertexArray(0);
+        // Invalidating the whole buffer lets the driver hand us fresh memory
+        // instead of stalling on draws still reading the previous batch.
+        void * verts = glMapBufferRange(GL_ARRAY_BUFFER, 0, maxCount * sizeof(dd::DrawVertex),
+                                        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
         glBindBuffer(GL_ARRAY_BUFFER, 0);
-        glBindTexture(GL_TEXTURE_2D,  0);
         checkGLError(__FILE__, __LINE__);
+        return verts;
+    }
+
+    void commitVertices(const dd::VertexBatch & batch) override
+    {
+        assert(batch.count > 0 && batch.count <= DEBUG_DRAW_VERTEX_BUFFER_SIZE);
+
+        glBindBuffer(GL_ARRAY_BUFFER, mappedVBO);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+
+        switch (batch.type)
+        {
+        case dd::PrimitivePoints :
+            drawLinePointBatch(GL_POINTS, batch.count, batch.depthEnabled);
+            break;
+        case dd::PrimitiveLines :
+            drawLinePointBatch(GL_LINES, batch.count, batch.depthEnabled);
+            break;
+        case dd::PrimitiveGlyphs :
+            drawGlyphBatch(batch.count, batch.glyphTex);
+            break;
+        } // switch (batch.type)
     }
 
     dd::GlyphTextureHandle createGlyphTexture(int width, int height, const void * pixels) override
@@ -179,6 +159,65 @@ public:
     // Local methods:
     //
 
+    // Draws 'count' verts already in the linePointVBO.
+    void drawLinePointBatch(GLenum mode, int count, bool depthEnabled)
+    {
+        glBindVertexArray(linePointVAO);
+        glUseProgram(linePointProgram);
+
+        glUniformMatrix4fv(linePointProgram_MvpMatrixLocation,
+                           1, GL_FALSE, toFloatPtr(mvpMatrix));
+
+        if (depthEnabled)
+        {
+            glEnable(GL_DEPTH_TEST);
+        }
+        else
+        {
+            glDisable(GL_DEPTH_TEST);
+        }
+
+        // Issue the draw call:
+        glDrawArrays(mode, 0, count);
+
+        glUseProgram(0);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        checkGLError(__FILE__, __LINE__);
+    }
+
+    // Draws 'count' verts already in the textVBO.
+    void drawGlyphBatch(int count, dd::GlyphTextureHandle glyphTex)
+    {
+        glBindVertexArray(textVAO);
+        glUseProgram(textProgram);
+
+        // These doesn't have to be reset every draw call, I'm just being lazy ;)
+        glUniform1i(textProgram_GlyphTextureLocation, 0);
+        glUniform2f(textProgram_ScreenDimensions,
+                    static_cast<GLfloat>(WindowWidth),
+                    static_cast<GLfloat>(WindowHeight));
+
+        if (glyphTex != nullptr)
+        {
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, handleToGL(glyphTex));
+        }
+
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glDisable(GL_DEPTH_TEST);
+
+        glDrawArrays(GL_TRIANGLES, 0, count); // Issue the draw call
+
+        glDisable(GL_BLEND);
+        glUseProgram(0);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindTexture(GL_TEXTURE_2D,  0);
+        checkGLError(__FILE__, __LINE__);
+    }
+
     DDRenderInterfaceCoreGL()
         : mvpMatrix(Matrix4::identity())
         , linePointProgram(0)
@@ -190,6 +229,7 @@ public:
         , linePointVBO(0)
         , textVAO(0)
         , textVBO(0)
+        , mappedVBO(0)
     {
         std::printf("\n");
         std::printf("GL_VENDOR    : %s\n",   glGetString(GL_VENDOR));
@@ -472,6 +512,8 @@ private:
     GLuint textVAO;
     GLuint textVBO;
 
+    GLuint mappedVBO; // VBO mapped by acquireVertices(), unmapped by commitVertices().
+
     static const char * linePointVertShaderSrc;
     static const char * linePointFragShaderSrc;
 
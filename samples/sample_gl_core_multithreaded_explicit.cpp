@@ -581,7 +581,11 @@ struct ThreadData
         renderInterface = ri;
         threadDrawFunc  = fn;
 
-        dd::initialize(&ddContext, renderInterface);
+        // Jobs publish their frames with dd::endFrame(), which the main thread
+        // draws with dd::flushSnapshot(), so neither waits on the other's draws.
+        dd::ContextConfig config;
+        config.frameSnapshots = true;
+        dd::initialize(&ddContext, renderInterface, config);
     }
 
     void shutdown()
@@ -740,29 +744,30 @@ static void drawText(const ThreadData & td)
 
 static void sampleAppDraw(DDRenderInterfaceCoreGL & ddRenderIfaceGL, ThreadData tds[4], JobQueue & jobQ)
 {
+    // The jobs of the previous frame ran while we were presenting it. They read
+    // the camera, so they must be done before it is updated for the next frame.
+    jobQ.waitAll();
+
     // Camera input update (the 'camera' object is declared in samples_common.hpp):
     camera.checkKeyboardMovement();
     camera.checkMouseRotation();
     camera.updateMatrices();
 
-    // Kick async render jobs:
+    // Kick async render jobs. Each one publishes a snapshot of its draws once done:
     for (int i = 0; i < 4; ++i)
     {
         const ThreadData & td = tds[i];
-        jobQ.pushJob([td]() { td.threadDrawFunc(td); });
+        jobQ.pushJob([td]() { td.threadDrawFunc(td); dd::endFrame(td.ddContext); });
     }
 
     // Begin a frame:
     ddRenderIfaceGL.prepareDraw(camera.vpMatrix);
 
-    // Wait async draws to complete. In a more real life scenario this would
-    // be the place to perform some other non-dependent work to avoid blocking.
-    jobQ.waitAll();
-
-    // Flush each individual context from the main thread:
+    // Draw the latest snapshot of each context from the main thread, without waiting
+    // on the jobs we just kicked. This is the previous frame's debug geometry.
     for (int i = 0; i < 4; ++i)
     {
-        dd::flush(tds[i].ddContext);
+        dd::flushSnapshot(tds[i].ddContext);
     }
 }
 
@@ -821,8 +826,8 @@ static void sampleAppStart()
     threads[3].init(&drawText,        &ddRenderIfaceGL);
 
     // Each draw function will be pushed into the async job queue
-    // by the main thread every frame, then main will wait on it
-    // and submit the GL draw commands with dd::flush().
+    // by the main thread every frame, while main submits the GL draw
+    // commands for the last finished frame with dd::flushSnapshot().
     JobQueue jobQ;
     jobQ.launch();
 